@@ -0,0 +1,208 @@
+// eitan.derdiger@gmail.com
+
+#include "Alloc.h"
+#include <atomic>      // for the huge page flag, pool counters
+#include <cstdlib>     // for aligned_alloc, free
+#include <new>         // for bad_alloc
+
+#ifdef __linux__
+#include <sys/mman.h>  // for madvise
+#endif
+
+namespace MatrixLib {
+
+namespace {
+
+std::atomic<bool> hugePages{false};
+
+void* defaultAllocate(std::size_t bytes, std::size_t align, void*) {
+    if (hugePages.load(std::memory_order_relaxed) && bytes >= HUGE_PAGE)
+        align = HUGE_PAGE;
+    std::size_t rounded = (bytes + align - 1) / align * align;  // aligned_alloc needs a multiple
+    void* p = std::aligned_alloc(align, rounded);
+#ifdef __linux__
+    if (p && align == HUGE_PAGE)
+        madvise(p, rounded, MADV_HUGEPAGE);  // only a hint; ignored without THP
+#endif
+    return p;
+}
+
+void defaultDeallocate(void* p, std::size_t, void*) {
+    std::free(p);
+}
+
+Allocator hook = {defaultAllocate, defaultDeallocate, nullptr};
+
+// ======= Pool =======
+
+constexpr std::size_t CLASSES = 11;   // 64 B .. 64 KB
+
+std::atomic<std::size_t> statRequests{0};
+std::atomic<std::size_t> statHits{0};
+std::atomic<std::size_t> statMisses{0};
+std::atomic<std::size_t> statHeld{0};
+
+// size class of a pool-sized request and its block size
+std::size_t classOf(std::size_t bytes) {
+    std::size_t c = 0;
+    while ((POOL_MIN_BYTES << c) < bytes) ++c;
+    return c;
+}
+
+// a free block stores the link to the next one in its first bytes
+struct FreeBlock { FreeBlock* next; };
+
+struct Pool {
+    FreeBlock* head[CLASSES] = {};
+    std::size_t held[CLASSES] = {};
+    int arenaDepth = 0;
+    double* scratch = nullptr;      // kept ScratchLease buffer
+    std::size_t scratchLen = 0;
+
+    void releaseAll() {
+        if (scratch) {
+            double* p = scratch;
+            scratch = nullptr;
+            detail::freeDoubles(p, scratchLen);
+            scratchLen = 0;
+        }
+        for (std::size_t c = 0; c < CLASSES; ++c) {
+            std::size_t size = POOL_MIN_BYTES << c;
+            while (FreeBlock* b = head[c]) {
+                head[c] = b->next;
+                hook.deallocate(b, size, hook.ctx);
+            }
+            statHeld.fetch_sub(held[c], std::memory_order_relaxed);
+            held[c] = 0;
+        }
+    }
+    ~Pool();
+};
+
+// Set once this thread's pool is destroyed: buffers freed later in thread
+// teardown (other thread_local objects) go straight to the hook
+thread_local bool poolGone = false;
+thread_local Pool pool;
+
+Pool::~Pool() {
+    releaseAll();
+    poolGone = true;
+}
+
+} // namespace
+
+// ======= Hook =======
+
+Allocator defaultAllocator() {
+    return {defaultAllocate, defaultDeallocate, nullptr};
+}
+
+void setAllocator(const Allocator& a) {
+    if (!poolGone) pool.releaseAll();
+    hook = (a.allocate && a.deallocate) ? a : defaultAllocator();
+}
+
+const Allocator& currentAllocator() {
+    return hook;
+}
+
+void setHugePages(bool enable) {
+    hugePages.store(enable);
+}
+
+PoolStats poolStats() {
+    return {statRequests.load(), statHits.load(), statMisses.load(), statHeld.load()};
+}
+
+void resetPoolStats() {
+    statRequests.store(0);
+    statHits.store(0);
+    statMisses.store(0);
+}
+
+MatrixArena::MatrixArena() {
+    ++pool.arenaDepth;
+}
+
+MatrixArena::~MatrixArena() {
+    if (--pool.arenaDepth == 0)
+        pool.releaseAll();
+}
+
+void MatrixArena::release() {
+    if (!poolGone) pool.releaseAll();
+}
+
+// ======= Buffers =======
+
+namespace detail {
+
+// Pool-sized requests always take whole class blocks (even when the pool is
+// bypassed), so a block can be cached or returned no matter where it is freed
+double* allocDoubles(std::size_t count) {
+    if (count == 0) return nullptr;
+    statRequests.fetch_add(1, std::memory_order_relaxed);
+    std::size_t bytes = count * sizeof(double);
+    if (bytes <= POOL_MAX_BYTES) {
+        std::size_t c = classOf(bytes);
+        bytes = POOL_MIN_BYTES << c;
+        if (!poolGone && pool.head[c]) {
+            FreeBlock* b = pool.head[c];
+            pool.head[c] = b->next;
+            pool.held[c] -= bytes;
+            statHeld.fetch_sub(bytes, std::memory_order_relaxed);
+            statHits.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<double*>(b);
+        }
+        statMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* p = hook.allocate(bytes, MATRIX_ALIGN, hook.ctx);
+    if (!p) throw std::bad_alloc();
+    return static_cast<double*>(p);
+}
+
+void freeDoubles(double* p, std::size_t count) {
+    if (!p) return;
+    std::size_t bytes = count * sizeof(double);
+    if (bytes <= POOL_MAX_BYTES) {
+        std::size_t c = classOf(bytes);
+        bytes = POOL_MIN_BYTES << c;
+        if (!poolGone && (pool.arenaDepth > 0 || pool.held[c] + bytes <= POOL_CLASS_BYTES)) {
+            FreeBlock* b = reinterpret_cast<FreeBlock*>(p);
+            b->next = pool.head[c];
+            pool.head[c] = b;
+            pool.held[c] += bytes;
+            statHeld.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+    }
+    hook.deallocate(p, bytes, hook.ctx);
+}
+
+// ======= Scratch Leases =======
+
+ScratchLease::ScratchLease(std::size_t count) {
+    if (!poolGone && pool.scratch && pool.scratchLen >= count) {
+        p = pool.scratch;
+        len = pool.scratchLen;
+        pool.scratch = nullptr;
+        pool.scratchLen = 0;
+        return;
+    }
+    p = allocDoubles(count);
+    len = count;
+}
+
+// keep the larger of this buffer and the one already kept
+ScratchLease::~ScratchLease() {
+    if (poolGone || (pool.scratch && pool.scratchLen >= len)) {
+        freeDoubles(p, len);
+        return;
+    }
+    if (pool.scratch) freeDoubles(pool.scratch, pool.scratchLen);
+    pool.scratch = p;
+    pool.scratchLen = len;
+}
+
+} // namespace detail
+} // namespace MatrixLib
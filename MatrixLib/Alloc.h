@@ -0,0 +1,121 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_ALLOC_H
+#define MATRIXLIB_ALLOC_H
+
+#include <cstddef>  // for size_t
+
+namespace MatrixLib {
+
+// ===== Storage Allocation =====
+//
+// Every matrix buffer (SquareMat storage, LU factors, the multiply workspace
+// and GEMM packing panels) comes from one process-wide allocator hook. The
+// default hook returns MATRIX_ALIGN-aligned blocks, so rows start on a cache
+// line and aligned vector loads never split one. With huge pages on, blocks of
+// at least HUGE_PAGE bytes are 2 MB aligned and advised as transparent huge
+// pages (Linux).
+
+// alignment of every matrix buffer (one cache line, one AVX-512 register)
+constexpr std::size_t MATRIX_ALIGN = 64;
+
+// huge page size used for big buffers when enabled
+constexpr std::size_t HUGE_PAGE = std::size_t(2) << 20;
+
+struct Allocator {
+    // at least `bytes` of storage aligned to `align` (a power of two), or nullptr
+    void* (*allocate)(std::size_t bytes, std::size_t align, void* ctx);
+    // give back a block from allocate (same byte count)
+    void (*deallocate)(void* p, std::size_t bytes, void* ctx);
+    void* ctx;
+};
+
+// the built-in aligned allocator
+Allocator defaultAllocator();
+
+// Install a hook (a default-constructed Allocator{} restores the default).
+// Call it while no other thread allocates matrices. Buffers that are still
+// alive (or cached by the pool on other threads) are later released through
+// the new hook, so a replacement must be able to free them - e.g. a wrapper
+// that forwards to defaultAllocator(). The calling thread's pool is emptied first.
+void setAllocator(const Allocator& a);
+
+// the hook in use
+const Allocator& currentAllocator();
+
+// back big buffers of the default allocator with huge pages (off by default)
+void setHugePages(bool enable);
+
+// ===== Small-Buffer Pool =====
+//
+// Buffers up to POOL_MAX_BYTES are recycled through per-thread free lists, one
+// per power-of-two size class, so the temporaries of small-matrix expressions
+// skip the allocator hook entirely. Each class keeps at most POOL_CLASS_BYTES
+// per thread; the surplus goes straight back to the hook.
+
+constexpr std::size_t POOL_MIN_BYTES = 64;                        // smallest class
+constexpr std::size_t POOL_MAX_BYTES = std::size_t(64) << 10;     // ~90 x 90 doubles
+constexpr std::size_t POOL_CLASS_BYTES = std::size_t(1) << 20;    // cache cap per class
+
+struct PoolStats {
+    std::size_t requests;    // buffers asked for (pooled or not)
+    std::size_t hits;        // served from a free list
+    std::size_t misses;      // pool-sized, but the free list was empty
+    std::size_t bytesHeld;   // bytes parked in free lists, all threads
+
+    double hitRate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+};
+
+// counters since start (or the last reset), summed over all threads
+PoolStats poolStats();
+void resetPoolStats();   // zero the counters (bytesHeld is a level, not a counter)
+
+// Scoped arena for bulk work. Inside it, every pool-sized buffer this thread
+// frees stays cached with no per-class cap, so a loop of small expressions
+// runs out of recycled memory; leaving the outermost scope hands everything
+// cached back to the hook at once. Matrices may outlive the scope - only the
+// free lists are released, never a live buffer.
+class MatrixArena {
+public:
+    MatrixArena();
+    ~MatrixArena();
+    MatrixArena(const MatrixArena&) = delete;
+    MatrixArena& operator=(const MatrixArena&) = delete;
+
+    // return this thread's cached buffers to the hook now
+    static void release();
+};
+
+namespace detail {
+
+// n doubles aligned to MATRIX_ALIGN, from the pool or the hook (nullptr for 0; throws std::bad_alloc)
+double* allocDoubles(std::size_t count);
+void freeDoubles(double* p, std::size_t count);
+
+// A workspace of at least `count` doubles (uninitialized). Each thread keeps
+// its largest returned one for the next lease, so per-task workspaces (GEMM
+// packing) reach the hook only when they grow; the kept buffer goes with the
+// rest of the thread's pool (MatrixArena::release, setAllocator, thread exit).
+class ScratchLease {
+    double* p;
+    std::size_t len;
+
+public:
+    explicit ScratchLease(std::size_t count);
+    ~ScratchLease();
+    ScratchLease(const ScratchLease&) = delete;
+    ScratchLease& operator=(const ScratchLease&) = delete;
+
+    double* data() const { return p; }
+};
+
+// Row stride for internal n x n workspaces: orders whose rows are a multiple
+// of 2 KB get one extra cache line per row, so walking down a column does not
+// land in the same few cache sets every time
+inline std::size_t paddedStride(std::size_t n) {
+    return (n >= 256 && n % 256 == 0) ? n + MATRIX_ALIGN / sizeof(double) : n;
+}
+
+} // namespace detail
+} // namespace MatrixLib
+#endif
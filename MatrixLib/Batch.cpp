@@ -0,0 +1,463 @@
+// eitan.derdiger@gmail.com
+
+// The kernels must not fuse a * b + c into an FMA (the avx512f and non-x86
+// targets have one): every ISA, and SquareMat, has to round the same way.
+// clang takes this for the whole file, ahead of the headers whose inline code
+// (detFixed) ends up in the kernels; GCC takes it per kernel (BATCH_ATTR).
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#define BATCH_NO_CONTRACT
+#elif defined(__GNUC__)
+#define BATCH_NO_CONTRACT optimize("fp-contract=off")
+#endif
+
+#include "Batch.h"
+#include "FixedSquareMat.h"   // detail::detFixed
+#include "Alloc.h"
+#include "Kernels.h"          // isaSupported
+#include "ThreadPool.h"
+#include <algorithm>   // for std::copy, std::fill, std::swap
+#include <limits>      // for quiet_NaN
+#include <stdexcept>   // for exceptions
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIXLIB_X86 1
+#endif
+
+using namespace MatrixLib;
+
+namespace {
+
+using detail::PAR_GRAIN;
+constexpr std::size_t L = BATCH_LANES;
+
+// ======= Lane Packs =======
+
+// One value of each matrix in a block of BATCH_LANES. The operators are plain
+// loops of fixed length, which the compiler turns into single vector
+// instructions of whatever width the calling kernel was built for (every
+// helper here is force-inlined into the per-ISA kernels below).
+struct Lanes {
+    double v[L];
+};
+
+MATRIXLIB_FORCE_INLINE Lanes operator+(const Lanes& a, const Lanes& b) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = a.v[l] + b.v[l];
+    return r;
+}
+MATRIXLIB_FORCE_INLINE Lanes operator-(const Lanes& a, const Lanes& b) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = a.v[l] - b.v[l];
+    return r;
+}
+MATRIXLIB_FORCE_INLINE Lanes operator*(const Lanes& a, const Lanes& b) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = a.v[l] * b.v[l];
+    return r;
+}
+MATRIXLIB_FORCE_INLINE Lanes operator/(const Lanes& a, const Lanes& b) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = a.v[l] / b.v[l];
+    return r;
+}
+MATRIXLIB_FORCE_INLINE Lanes load(const double* p) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = p[l];
+    return r;
+}
+MATRIXLIB_FORCE_INLINE void store(double* p, const Lanes& a) {
+    for (std::size_t l = 0; l < L; ++l) p[l] = a.v[l];
+}
+MATRIXLIB_FORCE_INLINE double labs(double x) { return x < 0 ? -x : x; }
+
+// ======= Block Kernels =======
+// One block = matrices [off, off + L). N is the order when known at compile
+// time (2 - 4), 0 for a runtime order n.
+
+// C = A * B, summed over k in order (same bits as SquareMat's small products)
+template <std::size_t N>
+MATRIXLIB_FORCE_INLINE void mulBlock(std::size_t n, const double* A, const double* B, double* C,
+                             std::size_t ld, std::size_t off) {
+    if (N) n = N;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            Lanes acc{};
+            for (std::size_t k = 0; k < n; ++k)
+                acc = acc + load(A + (i * n + k) * ld + off) * load(B + (k * n + j) * ld + off);
+            store(C + (i * n + j) * ld + off, acc);
+        }
+}
+
+// d[l] with operator!'s EPS rule, stored for the lanes below `count`
+MATRIXLIB_FORCE_INLINE void storeDet(const Lanes& d, const bool* dead, double* out,
+                             std::size_t off, std::size_t count) {
+    for (std::size_t l = 0; l < L && off + l < count; ++l)
+        out[off + l] = (dead && dead[l]) || labs(d.v[l]) < SquareMat::EPS ? 0.0 : d.v[l];
+}
+
+template <std::size_t N>
+MATRIXLIB_FORCE_INLINE void detClosedBlock(const double* A, std::size_t ld, double* out,
+                                   std::size_t off, std::size_t count) {
+    Lanes m[N * N];
+    for (std::size_t p = 0; p < N * N; ++p) m[p] = load(A + p * ld + off);
+    storeDet(detail::detFixed<N, Lanes>(m), nullptr, out, off, count);
+}
+
+// Partial pivoting, lane by lane: each lane picks its own pivot row and the
+// swaps are done as per-lane selects, so the block never splits up
+MATRIXLIB_FORCE_INLINE void pivotStep(std::size_t n, Lanes* m, Lanes* x, std::size_t i,
+                              bool* dead, Lanes& sign) {
+    std::size_t prow[L];
+    double best[L];
+    for (std::size_t l = 0; l < L; ++l) {
+        prow[l] = i;
+        best[l] = labs(m[i * n + i].v[l]);
+    }
+    for (std::size_t r = i + 1; r < n; ++r)
+        for (std::size_t l = 0; l < L; ++l) {
+            double a = labs(m[r * n + i].v[l]);
+            if (a > best[l]) { best[l] = a; prow[l] = r; }
+        }
+    for (std::size_t l = 0; l < L; ++l) {
+        if (best[l] < SquareMat::EPS) dead[l] = true;
+        if (prow[l] != i) sign.v[l] = -sign.v[l];
+    }
+    for (std::size_t r = i + 1; r < n; ++r)
+        for (std::size_t c = 0; c < n; ++c) {
+            if (c >= i) {
+                Lanes& a = m[i * n + c];
+                Lanes& b = m[r * n + c];
+                for (std::size_t l = 0; l < L; ++l)
+                    if (prow[l] == r) std::swap(a.v[l], b.v[l]);
+            }
+            if (x) {
+                Lanes& a = x[i * n + c];
+                Lanes& b = x[r * n + c];
+                for (std::size_t l = 0; l < L; ++l)
+                    if (prow[l] == r) std::swap(a.v[l], b.v[l]);
+            }
+        }
+}
+
+// pivot of column i, or 1 in lanes that are already singular (keeps them finite)
+MATRIXLIB_FORCE_INLINE Lanes livePivot(const Lanes& p, const bool* dead) {
+    Lanes r;
+    for (std::size_t l = 0; l < L; ++l) r.v[l] = dead[l] ? 1.0 : p.v[l];
+    return r;
+}
+
+// Same pivot choice, EPS rule and multiplication order as LU's elimination
+MATRIXLIB_FORCE_INLINE void detElimBlock(std::size_t n, const double* A, std::size_t ld, double* out,
+                                 std::size_t off, std::size_t count, Lanes* m) {
+    for (std::size_t p = 0; p < n * n; ++p) m[p] = load(A + p * ld + off);
+    bool dead[L] = {};
+    Lanes d;
+    for (std::size_t l = 0; l < L; ++l) d.v[l] = 1.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        pivotStep(n, m, nullptr, i, dead, d);
+        Lanes piv = livePivot(m[i * n + i], dead);
+        d = d * piv;
+        for (std::size_t r = i + 1; r < n; ++r) {
+            Lanes f = m[r * n + i] / piv;
+            for (std::size_t c = i + 1; c < n; ++c)
+                m[r * n + c] = m[r * n + c] - f * m[i * n + c];
+        }
+    }
+    storeDet(d, dead, out, off, count);
+}
+
+// Gauss-Jordan on [A | I]: x ends up as A^-1 in every live lane
+MATRIXLIB_FORCE_INLINE void invBlock(std::size_t n, const double* A, double* X, std::size_t ld,
+                             bool* deadOut, std::size_t off, Lanes* m) {
+    Lanes* x = m + n * n;
+    for (std::size_t p = 0; p < n * n; ++p) {
+        m[p] = load(A + p * ld + off);
+        x[p] = Lanes{};
+    }
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t l = 0; l < L; ++l) x[i * n + i].v[l] = 1.0;
+
+    bool dead[L] = {};
+    Lanes sign{};
+    for (std::size_t i = 0; i < n; ++i) {
+        pivotStep(n, m, x, i, dead, sign);
+        Lanes piv = livePivot(m[i * n + i], dead);
+        for (std::size_t c = i + 1; c < n; ++c) m[i * n + c] = m[i * n + c] / piv;
+        for (std::size_t c = 0; c < n; ++c) x[i * n + c] = x[i * n + c] / piv;
+        for (std::size_t r = 0; r < n; ++r) {
+            if (r == i) continue;
+            Lanes f = m[r * n + i];
+            for (std::size_t c = i + 1; c < n; ++c)
+                m[r * n + c] = m[r * n + c] - f * m[i * n + c];
+            for (std::size_t c = 0; c < n; ++c)
+                x[r * n + c] = x[r * n + c] - f * x[i * n + c];
+        }
+    }
+    for (std::size_t p = 0; p < n * n; ++p) store(X + p * ld + off, x[p]);
+    for (std::size_t l = 0; l < L; ++l) deadOut[off + l] = dead[l];
+}
+
+// ======= Per-ISA Kernels =======
+// Each ISA gets its own copy of the block loops. Contraction into FMA is off,
+// so every copy rounds exactly like the scalar code.
+
+using MulKernel = void (*)(std::size_t n, const double* A, const double* B, double* C,
+                           std::size_t ld, std::size_t b0, std::size_t b1);
+using DetKernel = void (*)(std::size_t n, const double* A, std::size_t ld, double* out,
+                           std::size_t count, std::size_t b0, std::size_t b1, Lanes* scratch);
+using InvKernel = void (*)(std::size_t n, const double* A, double* X, std::size_t ld,
+                           bool* dead, std::size_t b0, std::size_t b1, Lanes* scratch);
+
+struct BatchKernels {
+    MulKernel mul;
+    DetKernel det;
+    InvKernel inv;
+};
+
+#define MATRIXLIB_BATCH_KERNELS(SFX, ATTR)                                              \
+    ATTR void mulBatch##SFX(std::size_t n, const double* A, const double* B, double* C, \
+                            std::size_t ld, std::size_t b0, std::size_t b1) {           \
+        for (std::size_t b = b0; b < b1; ++b) {                                         \
+            std::size_t off = b * L;                                                    \
+            switch (n) {                                                                \
+            case 2:  mulBlock<2>(n, A, B, C, ld, off); break;                           \
+            case 3:  mulBlock<3>(n, A, B, C, ld, off); break;                           \
+            case 4:  mulBlock<4>(n, A, B, C, ld, off); break;                           \
+            default: mulBlock<0>(n, A, B, C, ld, off); break;                           \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+    ATTR void detBatch##SFX(std::size_t n, const double* A, std::size_t ld, double* out, \
+                            std::size_t count, std::size_t b0, std::size_t b1,          \
+                            Lanes* scratch) {                                           \
+        for (std::size_t b = b0; b < b1; ++b) {                                         \
+            std::size_t off = b * L;                                                    \
+            switch (n) {                                                                \
+            case 1:  detClosedBlock<1>(A, ld, out, off, count); break;                  \
+            case 2:  detClosedBlock<2>(A, ld, out, off, count); break;                  \
+            case 3:  detClosedBlock<3>(A, ld, out, off, count); break;                  \
+            case 4:  detClosedBlock<4>(A, ld, out, off, count); break;                  \
+            default: detElimBlock(n, A, ld, out, off, count, scratch); break;           \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+    ATTR void invBatch##SFX(std::size_t n, const double* A, double* X, std::size_t ld,  \
+                            bool* dead, std::size_t b0, std::size_t b1, Lanes* scratch) { \
+        for (std::size_t b = b0; b < b1; ++b)                                           \
+            invBlock(n, A, X, ld, dead, b * L, scratch);                                \
+    }
+
+#ifdef BATCH_NO_CONTRACT
+#define BATCH_ATTR(ISA) __attribute__((target(ISA), BATCH_NO_CONTRACT))
+#else
+#define BATCH_ATTR(ISA) __attribute__((target(ISA)))
+#endif
+
+#ifdef MATRIXLIB_X86
+MATRIXLIB_BATCH_KERNELS(Sse2, BATCH_ATTR("sse2"))
+MATRIXLIB_BATCH_KERNELS(Avx2, BATCH_ATTR("avx2"))
+MATRIXLIB_BATCH_KERNELS(Avx512, BATCH_ATTR("avx512f"))
+
+const BatchKernels SSE2_BATCH = {mulBatchSse2, detBatchSse2, invBatchSse2};
+const BatchKernels AVX2_BATCH = {mulBatchAvx2, detBatchAvx2, invBatchAvx2};
+const BatchKernels AVX512_BATCH = {mulBatchAvx512, detBatchAvx512, invBatchAvx512};
+#else
+#ifdef BATCH_NO_CONTRACT
+MATRIXLIB_BATCH_KERNELS(Portable, __attribute__((BATCH_NO_CONTRACT)))
+#else
+MATRIXLIB_BATCH_KERNELS(Portable, )
+#endif
+
+const BatchKernels PORTABLE_BATCH = {mulBatchPortable, detBatchPortable, invBatchPortable};
+#endif
+
+#undef MATRIXLIB_BATCH_KERNELS
+#undef BATCH_ATTR
+#undef BATCH_NO_CONTRACT
+
+const BatchKernels& batchKernels() {
+#ifdef MATRIXLIB_X86
+    static const BatchKernels& best =
+        detail::isaSupported(detail::Isa::AVX512) ? AVX512_BATCH :
+        detail::isaSupported(detail::Isa::AVX2)   ? AVX2_BATCH   :
+                                                    SSE2_BATCH;
+    return best;
+#else
+    return PORTABLE_BATCH;
+#endif
+}
+
+// lane blocks per pool task for kernels doing ~n^3 work per block
+std::size_t blockGrain(std::size_t n) {
+    return PAR_GRAIN / (n * n * n * L) + 1;
+}
+
+} // namespace
+
+// ======= Rule of Five =======
+
+SquareMatBatch::SquareMatBatch(std::size_t order, std::size_t count, double initVal)
+    : SquareMatBatch(order, count, Uninit{}) {
+    std::fill(planes, planes + n * n * ld, initVal);
+}
+
+// Allocate without filling (private; callers overwrite every plane)
+SquareMatBatch::SquareMatBatch(std::size_t order, std::size_t count, Uninit)
+    : n(order), cnt(count), ld((count + L - 1) / L * L), planes(nullptr) {
+    planes = detail::allocDoubles(n * n * ld);
+}
+
+SquareMatBatch::SquareMatBatch(const SquareMatBatch& other)
+    : SquareMatBatch(other.n, other.cnt, Uninit{}) {
+    std::copy(other.planes, other.planes + n * n * ld, planes);
+}
+
+SquareMatBatch& SquareMatBatch::operator=(const SquareMatBatch& other) {
+    if (this != &other) {
+        SquareMatBatch tmp(other);
+        std::swap(n, tmp.n);
+        std::swap(cnt, tmp.cnt);
+        std::swap(ld, tmp.ld);
+        std::swap(planes, tmp.planes);
+    }
+    return *this;
+}
+
+SquareMatBatch::SquareMatBatch(SquareMatBatch&& other) noexcept
+    : n(other.n), cnt(other.cnt), ld(other.ld), planes(other.planes) {
+    other.n = other.cnt = other.ld = 0;
+    other.planes = nullptr;
+}
+
+SquareMatBatch& SquareMatBatch::operator=(SquareMatBatch&& other) noexcept {
+    if (this != &other) {
+        detail::freeDoubles(planes, n * n * ld);
+        n = other.n;
+        cnt = other.cnt;
+        ld = other.ld;
+        planes = other.planes;
+        other.n = other.cnt = other.ld = 0;
+        other.planes = nullptr;
+    }
+    return *this;
+}
+
+SquareMatBatch::~SquareMatBatch() {
+    detail::freeDoubles(planes, n * n * ld);
+}
+
+// ======= Access =======
+
+SquareMat SquareMatBatch::get(std::size_t k) const {
+    if (k >= cnt) throw std::out_of_range("batch index");
+    SquareMat m(n);
+    double* d = m.data();
+    for (std::size_t p = 0; p < n * n; ++p) d[p] = planes[p * ld + k];
+    return m;
+}
+
+void SquareMatBatch::set(std::size_t k, const SquareMat& m) {
+    if (k >= cnt) throw std::out_of_range("batch index");
+    if (m.order() != n) throw std::invalid_argument("order mismatch");
+    const double* s = m.data();
+    for (std::size_t p = 0; p < n * n; ++p) planes[p * ld + k] = s[p];
+}
+
+// ======= Batched Operations =======
+
+void SquareMatBatch::mulInto(const SquareMatBatch& A, const SquareMatBatch& B, SquareMatBatch& C) {
+    std::size_t n = A.n, ld = A.ld;
+    MulKernel mul = batchKernels().mul;
+    ThreadPool::instance().parallelFor(ld / L, blockGrain(n), [&](std::size_t b0, std::size_t b1) {
+        mul(n, A.planes, B.planes, C.planes, ld, b0, b1);
+    });
+}
+
+namespace MatrixLib {
+
+SquareMatBatch operator*(const SquareMatBatch& A, const SquareMatBatch& B) {
+    if (A.n != B.n || A.cnt != B.cnt) throw std::invalid_argument("batch mismatch");
+    SquareMatBatch C(A.n, A.cnt, SquareMatBatch::Uninit{});
+    SquareMatBatch::mulInto(A, B, C);
+    return C;
+}
+
+} // namespace MatrixLib
+
+SquareMatBatch SquareMatBatch::operator~() const {
+    SquareMatBatch T(n, cnt, Uninit{});
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            std::copy(plane(j, i), plane(j, i) + ld, T.plane(i, j));
+    return T;
+}
+
+// Square-and-multiply over three batches that trade places by move
+SquareMatBatch SquareMatBatch::operator^(unsigned int p) const {
+    if (n == 0) throw std::logic_error("power of empty matrix");
+    SquareMatBatch res(n, cnt, 0.0);
+    if (p == 0) {
+        for (std::size_t i = 0; i < n; ++i)
+            std::fill(res.plane(i, i), res.plane(i, i) + ld, 1.0);
+        return res;
+    }
+    SquareMatBatch base(*this), tmp(n, cnt, Uninit{});
+    bool haveRes = false;
+    for (;;) {
+        if (p & 1) {
+            if (!haveRes) {
+                std::copy(base.planes, base.planes + n * n * ld, res.planes);
+                haveRes = true;
+            } else {
+                mulInto(res, base, tmp);
+                std::swap(res, tmp);
+            }
+        }
+        p >>= 1;
+        if (!p) break;
+        mulInto(base, base, tmp);
+        std::swap(base, tmp);
+    }
+    return res;
+}
+
+void SquareMatBatch::det(double* out) const {
+    if (n == 0) throw std::logic_error("det of empty matrix");
+    DetKernel det = batchKernels().det;
+    std::size_t scratch = n > 4 ? n * n * L : 0;
+    ThreadPool::instance().parallelFor(ld / L, blockGrain(n), [&](std::size_t b0, std::size_t b1) {
+        double* s = detail::allocDoubles(scratch);
+        det(n, planes, ld, out, cnt, b0, b1, reinterpret_cast<Lanes*>(s));
+        detail::freeDoubles(s, scratch);
+    });
+}
+
+SquareMatBatch SquareMatBatch::inverse(bool* singular) const {
+    if (n == 0) throw std::logic_error("inverse of empty matrix");
+    SquareMatBatch X(n, cnt, Uninit{});
+    bool* dead = new bool[ld];
+    InvKernel inv = batchKernels().inv;
+    std::size_t scratch = 2 * n * n * L;
+    ThreadPool::instance().parallelFor(ld / L, blockGrain(n), [&](std::size_t b0, std::size_t b1) {
+        double* s = detail::allocDoubles(scratch);
+        inv(n, planes, X.planes, ld, dead, b0, b1, reinterpret_cast<Lanes*>(s));
+        detail::freeDoubles(s, scratch);
+    });
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (std::size_t k = 0; k < cnt; ++k) {
+        if (!dead[k]) {
+            if (singular) singular[k] = false;
+            continue;
+        }
+        if (!singular) {
+            delete[] dead;
+            throw std::logic_error("singular matrix");
+        }
+        singular[k] = true;
+        for (std::size_t p = 0; p < n * n; ++p) X.planes[p * ld + k] = nan;
+    }
+    delete[] dead;
+    return X;
+}
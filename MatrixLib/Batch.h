@@ -0,0 +1,96 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_BATCH_H
+#define MATRIXLIB_BATCH_H
+
+#include <cstddef>      // for size_t
+#include "Config.h"     // MATRIXLIB_BOUNDS_CHECK
+#include "SquareMat.h"
+
+namespace MatrixLib {
+
+// ===== Matrix Batch =====
+//
+// `count` independent n x n matrices in structure-of-arrays layout: plane
+// (i, j) holds element (i, j) of every matrix contiguously, so one vector
+// register covers the same element of 8 matrices and the batched kernels
+// below run SIMD across the batch instead of inside a matrix. Planes are
+// padded to BATCH_LANES matrices, so each starts on a cache line.
+// Kernels are picked once per instruction set (like the element-wise kernel
+// table) and give the same bits on every one; each matrix of a result is
+// independent of the others and of the thread count.
+
+// matrices handled together by one kernel step (one AVX-512 register)
+constexpr std::size_t BATCH_LANES = 8;
+
+class SquareMatBatch {
+    std::size_t n;       // order of every matrix
+    std::size_t cnt;     // number of matrices
+    std::size_t ld;      // plane stride: cnt rounded up to BATCH_LANES
+    double* planes;      // n * n planes of ld values
+
+    // allocate without filling (every plane is written right after)
+    struct Uninit {};
+    SquareMatBatch(std::size_t order, std::size_t count, Uninit);
+
+    // C[k] = A[k] * B[k] into existing storage (C distinct from A and B)
+    static void mulInto(const SquareMatBatch& A, const SquareMatBatch& B, SquareMatBatch& C);
+
+public:
+    // ===== Rule of Five =====
+
+    // `count` matrices of the given order, every element initVal
+    SquareMatBatch(std::size_t order, std::size_t count, double initVal = 0.0);
+
+    SquareMatBatch(const SquareMatBatch& other);
+    SquareMatBatch& operator=(const SquareMatBatch& other);
+    SquareMatBatch(SquareMatBatch&& other) noexcept;
+    SquareMatBatch& operator=(SquareMatBatch&& other) noexcept;
+    ~SquareMatBatch();
+
+    // ===== Access =====
+
+    [[nodiscard]] std::size_t order() const { return n; }
+    [[nodiscard]] std::size_t count() const { return cnt; }
+
+    // element (i, j) of matrix k (checked unless MATRIXLIB_BOUNDS_CHECK is 0)
+    double& at(std::size_t k, std::size_t i, std::size_t j) {
+        if (MATRIXLIB_BOUNDS_CHECK && (k >= cnt || i >= n || j >= n)) throw std::out_of_range("batch index");
+        return planes[(i * n + j) * ld + k];
+    }
+    double at(std::size_t k, std::size_t i, std::size_t j) const {
+        if (MATRIXLIB_BOUNDS_CHECK && (k >= cnt || i >= n || j >= n)) throw std::out_of_range("batch index");
+        return planes[(i * n + j) * ld + k];
+    }
+
+    // element (i, j) of all matrices: count() contiguous values
+    double*       plane(std::size_t i, std::size_t j) { return planes + (i * n + j) * ld; }
+    const double* plane(std::size_t i, std::size_t j) const { return planes + (i * n + j) * ld; }
+
+    // copy matrix k out / in
+    SquareMat get(std::size_t k) const;
+    void set(std::size_t k, const SquareMat& m);
+
+    // ===== Batched Operations =====
+
+    // C[k] = A[k] * B[k] (same order and count)
+    friend SquareMatBatch operator*(const SquareMatBatch& A, const SquareMatBatch& B);
+
+    // transpose of every matrix (a permutation of whole planes)
+    SquareMatBatch operator~() const;
+
+    // A[k]^p for every matrix (square-and-multiply on the whole batch)
+    SquareMatBatch operator^(unsigned int p) const;
+
+    // out[k] = det(A[k]) for k < count(), computed like operator!: closed
+    // forms up to 4 x 4, pivoted elimination above, the same EPS rule
+    void det(double* out) const;
+
+    // Inverse of every matrix (Gauss-Jordan with partial pivoting). A matrix
+    // with a pivot below EPS is singular: with `singular` (count() flags) it is
+    // flagged and its inverse is all NaN, otherwise std::logic_error is thrown.
+    SquareMatBatch inverse(bool* singular = nullptr) const;
+};
+
+} // namespace MatrixLib
+#endif
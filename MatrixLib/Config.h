@@ -0,0 +1,33 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_CONFIG_H
+#define MATRIXLIB_CONFIG_H
+
+// ===== Build Configuration =====
+
+// Bounds checks on operator[] (std::out_of_range on a bad row).
+// On by default, off in release builds (NDEBUG); -DMATRIXLIB_BOUNDS_CHECK=0/1 overrides.
+// at_unchecked(), row_ptr() and data() never check.
+#ifndef MATRIXLIB_BOUNDS_CHECK
+#ifdef NDEBUG
+#define MATRIXLIB_BOUNDS_CHECK 0
+#else
+#define MATRIXLIB_BOUNDS_CHECK 1
+#endif
+#endif
+
+// Matrices up to this order keep their elements inside the object (no heap
+// buffer at all); -DMATRIXLIB_INLINE_ORDER=0 turns that off. Default 4 (16 doubles).
+#ifndef MATRIXLIB_INLINE_ORDER
+#define MATRIXLIB_INLINE_ORDER 4
+#endif
+
+// Small shared helpers that must be inlined into their caller, e.g. so a
+// kernel built for AVX-512 also runs them with AVX-512 instructions
+#if defined(__GNUC__) || defined(__clang__)
+#define MATRIXLIB_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define MATRIXLIB_FORCE_INLINE inline
+#endif
+
+#endif
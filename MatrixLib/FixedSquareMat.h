@@ -0,0 +1,312 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_FIXEDSQUAREMAT_H
+#define MATRIXLIB_FIXEDSQUAREMAT_H
+
+#include <cstddef>          // for size_t
+#include <iostream>         // for ostream
+#include <stdexcept>        // for exceptions
+#include <initializer_list> // for initializer_list
+#include <cmath>            // for fmod
+#include <algorithm>        // for std::copy
+#include "Config.h"         // MATRIXLIB_BOUNDS_CHECK, MATRIXLIB_FORCE_INLINE
+#include "SquareMat.h"      // conversions, EPS
+
+namespace MatrixLib {
+
+// ===== Fixed-Order Matrix =====
+//
+// FixedSquareMat<N>: an N x N matrix whose order is a template argument. The
+// elements live in the object, every loop has a compile-time trip count (so
+// the compiler unrolls it and keeps small matrices in registers), and all
+// operations except % int are constexpr. Semantics match SquareMat: % is
+// element-wise, comparisons go by sum with EPS, ! is the determinant.
+// Orders 2 - 4 get closed-form determinants.
+
+namespace detail {
+
+constexpr double cabs(double x) { return x < 0 ? -x : x; }
+
+// 2 x 2 minor from rows r0, r1 and columns c0, c1 of a row-major N x N array
+template <std::size_t N, class T>
+MATRIXLIB_FORCE_INLINE constexpr T minor2(const T* a, std::size_t r0, std::size_t r1, std::size_t c0, std::size_t c1) {
+    return a[r0 * N + c0] * a[r1 * N + c1] - a[r0 * N + c1] * a[r1 * N + c0];
+}
+
+// Determinant of a row-major N x N array: closed forms up to 4 x 4, above
+// that pivoted elimination on a local copy with the same pivot choice, EPS
+// rule and multiplication order as LU (so both give the same bits). Also
+// serves SquareMat::operator! for small runtime orders. The closed forms only
+// use + - *, so T may also be a SIMD lane pack (SquareMatBatch).
+template <std::size_t N, class T = double>
+MATRIXLIB_FORCE_INLINE constexpr T detFixed(const T* a) {
+    if constexpr (N == 1) {
+        return a[0];
+    } else if constexpr (N == 2) {
+        return a[0] * a[3] - a[1] * a[2];
+    } else if constexpr (N == 3) {
+        return a[0] * (a[4] * a[8] - a[5] * a[7])
+             - a[1] * (a[3] * a[8] - a[5] * a[6])
+             + a[2] * (a[3] * a[7] - a[4] * a[6]);
+    } else if constexpr (N == 4) {
+        // Laplace expansion over the 2 x 2 minors of the top and bottom row pairs
+        return minor2<4>(a, 0, 1, 0, 1) * minor2<4>(a, 2, 3, 2, 3)
+             - minor2<4>(a, 0, 1, 0, 2) * minor2<4>(a, 2, 3, 1, 3)
+             + minor2<4>(a, 0, 1, 0, 3) * minor2<4>(a, 2, 3, 1, 2)
+             + minor2<4>(a, 0, 1, 1, 2) * minor2<4>(a, 2, 3, 0, 3)
+             - minor2<4>(a, 0, 1, 1, 3) * minor2<4>(a, 2, 3, 0, 2)
+             + minor2<4>(a, 0, 1, 2, 3) * minor2<4>(a, 2, 3, 0, 1);
+    } else {
+        double m[N * N]{};
+        for (std::size_t i = 0; i < N * N; ++i) m[i] = a[i];
+        double d = 1.0;
+        for (std::size_t i = 0; i < N; ++i) {
+            std::size_t p = i;
+            for (std::size_t r = i + 1; r < N; ++r)
+                if (cabs(m[r * N + i]) > cabs(m[p * N + i])) p = r;
+            if (cabs(m[p * N + i]) < SquareMat::EPS) return 0.0;
+            if (p != i) {
+                for (std::size_t c = i; c < N; ++c) {
+                    double t = m[i * N + c];
+                    m[i * N + c] = m[p * N + c];
+                    m[p * N + c] = t;
+                }
+                d = -d;
+            }
+            double piv = m[i * N + i];
+            d *= piv;
+            for (std::size_t r = i + 1; r < N; ++r) {
+                double f = m[r * N + i] / piv;
+                for (std::size_t c = i + 1; c < N; ++c)
+                    m[r * N + c] -= f * m[i * N + c];
+            }
+        }
+        return d;
+    }
+}
+
+} // namespace detail
+
+template <std::size_t N>
+class FixedSquareMat {
+    static_assert(N > 0, "FixedSquareMat needs a positive order");
+
+    double a[N * N]{};   // row-major
+
+public:
+    // ===== Constructors =====
+
+    // every element set to initVal (default 0)
+    constexpr explicit FixedSquareMat(double initVal = 0.0) {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] = initVal;
+    }
+
+    // from a nested initializer list with exactly N rows of N values
+    constexpr FixedSquareMat(std::initializer_list<std::initializer_list<double>> init) {
+        if (init.size() != N) throw std::invalid_argument("order mismatch");
+        std::size_t r = 0;
+        for (const auto& row : init) {
+            if (row.size() != N) throw std::invalid_argument("not square");
+            std::size_t c = 0;
+            for (double v : row) a[r * N + c++] = v;
+            ++r;
+        }
+    }
+
+    // from a dynamic matrix of order N
+    explicit FixedSquareMat(const SquareMat& m) {
+        if (m.order() != N) throw std::invalid_argument("order mismatch");
+        std::copy(m.data(), m.data() + N * N, a);
+    }
+
+    // to a dynamic matrix (no heap buffer up to SquareMat::INLINE_ORDER)
+    SquareMat toSquareMat() const {
+        SquareMat m(N);
+        std::copy(a, a + N * N, m.data());
+        return m;
+    }
+    explicit operator SquareMat() const { return toSquareMat(); }
+
+    static constexpr FixedSquareMat identity() {
+        FixedSquareMat I;
+        for (std::size_t i = 0; i < N; ++i) I.a[i * N + i] = 1.0;
+        return I;
+    }
+
+    // ===== Element Access =====
+
+    constexpr double* operator[](std::size_t row) {
+        if (MATRIXLIB_BOUNDS_CHECK && row >= N) throw std::out_of_range("row");
+        return a + row * N;
+    }
+    constexpr const double* operator[](std::size_t row) const {
+        if (MATRIXLIB_BOUNDS_CHECK && row >= N) throw std::out_of_range("row");
+        return a + row * N;
+    }
+
+    constexpr double* data() { return a; }
+    constexpr const double* data() const { return a; }
+    static constexpr std::size_t order() { return N; }
+    static constexpr std::size_t size() { return N * N; }
+
+    // ===== Reductions =====
+
+    constexpr double sum() const {
+        double s = 0;
+        for (std::size_t i = 0; i < N * N; ++i) s += a[i];
+        return s;
+    }
+
+    constexpr double trace() const {
+        double s = 0;
+        for (std::size_t i = 0; i < N; ++i) s += a[i * N + i];
+        return s;
+    }
+
+    // ===== Compound Assignment =====
+
+    constexpr FixedSquareMat& operator+=(const FixedSquareMat& r) {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] += r.a[i];
+        return *this;
+    }
+    constexpr FixedSquareMat& operator-=(const FixedSquareMat& r) {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] -= r.a[i];
+        return *this;
+    }
+    constexpr FixedSquareMat& operator%=(const FixedSquareMat& r) {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] *= r.a[i];
+        return *this;
+    }
+    constexpr FixedSquareMat& operator*=(const FixedSquareMat& r) { return *this = *this * r; }
+    constexpr FixedSquareMat& operator*=(double s) {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] *= s;
+        return *this;
+    }
+    constexpr FixedSquareMat& operator/=(double s) {
+        if (detail::cabs(s) < SquareMat::EPS) throw std::invalid_argument("divide by 0");
+        for (std::size_t i = 0; i < N * N; ++i) a[i] /= s;
+        return *this;
+    }
+    // non-negative remainder, like SquareMat (not constexpr: uses std::fmod)
+    FixedSquareMat& operator%=(int m) {
+        if (m == 0) throw std::invalid_argument("mod 0");
+        for (std::size_t i = 0; i < N * N; ++i) {
+            a[i] = std::fmod(a[i], static_cast<double>(m));
+            if (a[i] < 0) a[i] += m;
+        }
+        return *this;
+    }
+
+    // ===== Increment / Decrement =====
+
+    constexpr FixedSquareMat& operator++() {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] += 1.0;
+        return *this;
+    }
+    constexpr FixedSquareMat operator++(int) {
+        FixedSquareMat t(*this);
+        ++*this;
+        return t;
+    }
+    constexpr FixedSquareMat& operator--() {
+        for (std::size_t i = 0; i < N * N; ++i) a[i] -= 1.0;
+        return *this;
+    }
+    constexpr FixedSquareMat operator--(int) {
+        FixedSquareMat t(*this);
+        --*this;
+        return t;
+    }
+
+    // ===== Binary Operators =====
+
+    friend constexpr FixedSquareMat operator+(FixedSquareMat l, const FixedSquareMat& r) { return l += r; }
+    friend constexpr FixedSquareMat operator-(FixedSquareMat l, const FixedSquareMat& r) { return l -= r; }
+    friend constexpr FixedSquareMat operator%(FixedSquareMat l, const FixedSquareMat& r) { return l %= r; }
+    friend constexpr FixedSquareMat operator*(FixedSquareMat l, double s) { return l *= s; }
+    friend constexpr FixedSquareMat operator*(double s, FixedSquareMat r) { return r *= s; }
+    friend constexpr FixedSquareMat operator/(FixedSquareMat l, double s) { return l /= s; }
+    friend FixedSquareMat operator%(FixedSquareMat l, int m) { return l %= m; }
+
+    // matrix product; i-k-j order so the inner loop runs along rows of r and the result
+    friend constexpr FixedSquareMat operator*(const FixedSquareMat& l, const FixedSquareMat& r) {
+        FixedSquareMat c;
+        for (std::size_t i = 0; i < N; ++i)
+            for (std::size_t k = 0; k < N; ++k) {
+                double x = l.a[i * N + k];
+                for (std::size_t j = 0; j < N; ++j)
+                    c.a[i * N + j] += x * r.a[k * N + j];
+            }
+        return c;
+    }
+
+    // ===== Unary Operators =====
+
+    constexpr FixedSquareMat operator-() const { return *this * -1.0; }
+
+    // transpose
+    constexpr FixedSquareMat operator~() const {
+        FixedSquareMat t;
+        for (std::size_t i = 0; i < N; ++i)
+            for (std::size_t j = 0; j < N; ++j)
+                t.a[j * N + i] = a[i * N + j];
+        return t;
+    }
+
+    // power by square-and-multiply
+    constexpr FixedSquareMat operator^(unsigned int k) const {
+        FixedSquareMat res = identity(), base = *this;
+        for (; k; k >>= 1) {
+            if (k & 1) res = res * base;
+            if (k > 1) base = base * base;
+        }
+        return res;
+    }
+
+    // determinant (|det| < EPS reads as 0, like SquareMat)
+    constexpr double operator!() const {
+        double d = det();
+        return detail::cabs(d) < SquareMat::EPS ? 0.0 : d;
+    }
+
+private:
+    constexpr double det() const { return detail::detFixed<N>(a); }
+};
+
+// ===== Comparison Operators (based on sum) =====
+
+template <std::size_t N>
+constexpr bool operator==(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return detail::cabs(l.sum() - r.sum()) < SquareMat::EPS;
+}
+template <std::size_t N>
+constexpr bool operator!=(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return !(l == r);
+}
+template <std::size_t N>
+constexpr bool operator<(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return l.sum() < r.sum() - SquareMat::EPS;
+}
+template <std::size_t N>
+constexpr bool operator<=(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return l < r || l == r;
+}
+template <std::size_t N>
+constexpr bool operator>(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return r < l;
+}
+template <std::size_t N>
+constexpr bool operator>=(const FixedSquareMat<N>& l, const FixedSquareMat<N>& r) {
+    return r <= l;
+}
+
+// ===== I/O =====
+
+// same layout as SquareMat
+template <std::size_t N>
+std::ostream& operator<<(std::ostream& os, const FixedSquareMat<N>& m) {
+    return detail::writeText(os, m.data(), N);
+}
+
+} // namespace MatrixLib
+#endif
@@ -0,0 +1,268 @@
+// eitan.derdiger@gmail.com
+
+// The microkernels multiply and then add; avx512f implies FMA, and GCC (C++)
+// and clang would otherwise fuse the pair, so each ISA would round differently
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#define GEMM_ATTR(ISA) __attribute__((target(ISA)))
+#elif defined(__GNUC__)
+#define GEMM_ATTR(ISA) __attribute__((target(ISA), optimize("fp-contract=off")))
+#endif
+
+#include "Gemm.h"
+#include "ThreadPool.h"
+#include "Alloc.h"
+#include "Kernels.h"   // isaSupported
+#include <algorithm>   // for std::min, std::fill
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIXLIB_X86 1
+#include <immintrin.h>
+#endif
+
+namespace MatrixLib {
+namespace detail {
+
+namespace {
+
+constexpr std::size_t MR = GEMM_MR;
+constexpr std::size_t NR = GEMM_NR;
+
+// element (i, p) of op(A)
+inline double opA(const double* A, std::size_t lda, bool trans, std::size_t i, std::size_t p) {
+    return trans ? A[p * lda + i] : A[i * lda + p];
+}
+
+// Pack an mc x kc block of op(A) into MR-row slivers.
+// Each sliver stores column p as MR consecutive values; short slivers are zero padded.
+void packA(std::size_t mc, std::size_t kc, const double* A, std::size_t lda, bool trans,
+           std::size_t i0, std::size_t p0, double* out) {
+    for (std::size_t ir = 0; ir < mc; ir += MR) {
+        std::size_t mr = std::min(MR, mc - ir);
+        for (std::size_t p = 0; p < kc; ++p) {
+            for (std::size_t i = 0; i < mr; ++i)
+                out[i] = opA(A, lda, trans, i0 + ir + i, p0 + p);
+            for (std::size_t i = mr; i < MR; ++i)
+                out[i] = 0.0;
+            out += MR;
+        }
+    }
+}
+
+// Pack a kc x nc block of op(B) into NR-column slivers.
+// Each sliver stores row p as NR consecutive values; short slivers are zero padded.
+void packB(std::size_t kc, std::size_t nc, const double* B, std::size_t ldb, bool trans,
+           std::size_t p0, std::size_t j0, double* out) {
+    for (std::size_t jr = 0; jr < nc; jr += NR) {
+        std::size_t nr = std::min(NR, nc - jr);
+        for (std::size_t p = 0; p < kc; ++p) {
+            if (!trans) {
+                const double* src = B + (p0 + p) * ldb + j0 + jr;
+                for (std::size_t j = 0; j < nr; ++j)
+                    out[j] = src[j];
+            } else {
+                for (std::size_t j = 0; j < nr; ++j)
+                    out[j] = B[(j0 + jr + j) * ldb + p0 + p];
+            }
+            for (std::size_t j = nr; j < NR; ++j)
+                out[j] = 0.0;
+            out += NR;
+        }
+    }
+}
+
+// ======= Microkernels =======
+//
+// C[0..mr, 0..nr) += alpha * (a-sliver * b-sliver), the full MR x NR tile
+// accumulated in registers and only the valid part written. One version per
+// instruction set, picked once from CPUID like the element-wise tables. All
+// of them multiply and then add (no FMA), in the same order, so every ISA
+// gives the same bits.
+
+using MicroKernel = void (*)(std::size_t kc, const double* a, const double* b,
+                             double* C, std::size_t ldc, std::size_t mr, std::size_t nr, double alpha);
+
+// write back an accumulated tile (edge tiles, and the portable kernel)
+inline void storeTile(const double (&acc)[MR][NR], double* C, std::size_t ldc,
+                      std::size_t mr, std::size_t nr, double alpha) {
+    for (std::size_t i = 0; i < mr; ++i)
+        for (std::size_t j = 0; j < nr; ++j)
+            C[i * ldc + j] += alpha * acc[i][j];
+}
+
+void microKernelPortable(std::size_t kc, const double* a, const double* b,
+                         double* C, std::size_t ldc, std::size_t mr, std::size_t nr, double alpha) {
+    double acc[MR][NR] = {};
+    for (std::size_t p = 0; p < kc; ++p) {
+        for (std::size_t i = 0; i < MR; ++i) {
+            double ai = a[i];
+            for (std::size_t j = 0; j < NR; ++j)
+                acc[i][j] += ai * b[j];
+        }
+        a += MR;
+        b += NR;
+    }
+    storeTile(acc, C, ldc, mr, nr, alpha);
+}
+
+#ifdef MATRIXLIB_X86
+
+static_assert(MR == 4 && NR == 8, "the x86 microkernels hold a 4 x 8 tile");
+
+// 4 x 8 tile in eight ymm accumulators (two per row)
+GEMM_ATTR("avx2")
+void microKernelAvx2(std::size_t kc, const double* a, const double* b,
+                     double* C, std::size_t ldc, std::size_t mr, std::size_t nr, double alpha) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    for (std::size_t p = 0; p < kc; ++p) {
+        __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+        __m256d a0 = _mm256_broadcast_sd(a), a1 = _mm256_broadcast_sd(a + 1);
+        __m256d a2 = _mm256_broadcast_sd(a + 2), a3 = _mm256_broadcast_sd(a + 3);
+        c00 = _mm256_add_pd(c00, _mm256_mul_pd(a0, b0));
+        c01 = _mm256_add_pd(c01, _mm256_mul_pd(a0, b1));
+        c10 = _mm256_add_pd(c10, _mm256_mul_pd(a1, b0));
+        c11 = _mm256_add_pd(c11, _mm256_mul_pd(a1, b1));
+        c20 = _mm256_add_pd(c20, _mm256_mul_pd(a2, b0));
+        c21 = _mm256_add_pd(c21, _mm256_mul_pd(a2, b1));
+        c30 = _mm256_add_pd(c30, _mm256_mul_pd(a3, b0));
+        c31 = _mm256_add_pd(c31, _mm256_mul_pd(a3, b1));
+        a += MR;
+        b += NR;
+    }
+    if (mr == MR && nr == NR) {
+        __m256d va = _mm256_set1_pd(alpha);
+        __m256d acc[MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+        for (std::size_t i = 0; i < MR; ++i) {
+            double* row = C + i * ldc;
+            _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), _mm256_mul_pd(va, acc[i][0])));
+            _mm256_storeu_pd(row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), _mm256_mul_pd(va, acc[i][1])));
+        }
+        return;
+    }
+    double acc[MR][NR];
+    _mm256_storeu_pd(acc[0], c00); _mm256_storeu_pd(acc[0] + 4, c01);
+    _mm256_storeu_pd(acc[1], c10); _mm256_storeu_pd(acc[1] + 4, c11);
+    _mm256_storeu_pd(acc[2], c20); _mm256_storeu_pd(acc[2] + 4, c21);
+    _mm256_storeu_pd(acc[3], c30); _mm256_storeu_pd(acc[3] + 4, c31);
+    storeTile(acc, C, ldc, mr, nr, alpha);
+}
+
+// 4 x 8 tile in four zmm accumulators (one per row)
+GEMM_ATTR("avx512f")
+void microKernelAvx512(std::size_t kc, const double* a, const double* b,
+                       double* C, std::size_t ldc, std::size_t mr, std::size_t nr, double alpha) {
+    __m512d c0 = _mm512_setzero_pd(), c1 = _mm512_setzero_pd();
+    __m512d c2 = _mm512_setzero_pd(), c3 = _mm512_setzero_pd();
+    for (std::size_t p = 0; p < kc; ++p) {
+        __m512d vb = _mm512_loadu_pd(b);
+        c0 = _mm512_add_pd(c0, _mm512_mul_pd(_mm512_set1_pd(a[0]), vb));
+        c1 = _mm512_add_pd(c1, _mm512_mul_pd(_mm512_set1_pd(a[1]), vb));
+        c2 = _mm512_add_pd(c2, _mm512_mul_pd(_mm512_set1_pd(a[2]), vb));
+        c3 = _mm512_add_pd(c3, _mm512_mul_pd(_mm512_set1_pd(a[3]), vb));
+        a += MR;
+        b += NR;
+    }
+    if (mr == MR && nr == NR) {
+        __m512d va = _mm512_set1_pd(alpha);
+        __m512d acc[MR] = {c0, c1, c2, c3};
+        for (std::size_t i = 0; i < MR; ++i) {
+            double* row = C + i * ldc;
+            _mm512_storeu_pd(row, _mm512_add_pd(_mm512_loadu_pd(row), _mm512_mul_pd(va, acc[i])));
+        }
+        return;
+    }
+    double acc[MR][NR];
+    _mm512_storeu_pd(acc[0], c0);
+    _mm512_storeu_pd(acc[1], c1);
+    _mm512_storeu_pd(acc[2], c2);
+    _mm512_storeu_pd(acc[3], c3);
+    storeTile(acc, C, ldc, mr, nr, alpha);
+}
+
+#endif
+#undef GEMM_ATTR
+
+MicroKernel microKernel() {
+#ifdef MATRIXLIB_X86
+    static const MicroKernel best =
+        isaSupported(Isa::AVX512) ? microKernelAvx512 :
+        isaSupported(Isa::AVX2)   ? microKernelAvx2   :
+                                    microKernelPortable;
+    return best;
+#else
+    return microKernelPortable;
+#endif
+}
+
+// Scale C by beta (beta == 0 overwrites, so stale NaNs never leak through)
+void scaleC(std::size_t M, std::size_t N, double beta, double* C, std::size_t ldc) {
+    if (beta == 1.0) return;
+    for (std::size_t i = 0; i < M; ++i) {
+        double* row = C + i * ldc;
+        if (beta == 0.0)
+            std::fill(row, row + N, 0.0);
+        else
+            for (std::size_t j = 0; j < N; ++j)
+                row[j] *= beta;
+    }
+}
+
+} // namespace
+
+void gemm(std::size_t M, std::size_t N, std::size_t K, double alpha,
+          const double* A, std::size_t lda, bool transA,
+          const double* B, std::size_t ldb, bool transB,
+          double beta, double* C, std::size_t ldc) {
+    if (M == 0 || N == 0) return;
+    scaleC(M, N, beta, C, ldc);
+    if (K == 0 || alpha == 0.0) return;
+
+    // packing buffers, rounded up to whole slivers (A goes into each thread's
+    // scratch buffer, reused across blocks and calls)
+    std::size_t kcMax = std::min(GEMM_KC, K);
+    std::size_t mcMax = (std::min(GEMM_MC, M) + MR - 1) / MR * MR;
+    std::size_t ncMax = (std::min(GEMM_NC, N) + NR - 1) / NR * NR;
+    double* packedB = allocDoubles(kcMax * ncMax);
+    MicroKernel kernel = microKernel();
+
+    // Row blocks of C are independent, so they are spread over the pool.
+    // Each C element sees the same operations in the same order either way.
+    std::size_t blocks = (M + GEMM_MC - 1) / GEMM_MC;
+    std::size_t grain = (M * N * K < GEMM_PAR_MIN_WORK) ? blocks : 1;
+
+    for (std::size_t jc = 0; jc < N; jc += GEMM_NC) {
+        std::size_t nc = std::min(GEMM_NC, N - jc);
+        for (std::size_t pc = 0; pc < K; pc += GEMM_KC) {
+            std::size_t kc = std::min(GEMM_KC, K - pc);
+            packB(kc, nc, B, ldb, transB, pc, jc, packedB);
+
+            ThreadPool::instance().parallelFor(blocks, grain, [&](std::size_t b0, std::size_t b1) {
+                ScratchLease lease(mcMax * kcMax);
+                double* packedA = lease.data();
+                for (std::size_t blk = b0; blk < b1; ++blk) {
+                    std::size_t ic = blk * GEMM_MC;
+                    std::size_t mc = std::min(GEMM_MC, M - ic);
+                    packA(mc, kc, A, lda, transA, ic, pc, packedA);
+
+                    for (std::size_t jr = 0; jr < nc; jr += NR) {
+                        std::size_t nr = std::min(NR, nc - jr);
+                        const double* b = packedB + jr * kc;
+                        for (std::size_t ir = 0; ir < mc; ir += MR) {
+                            std::size_t mr = std::min(MR, mc - ir);
+                            kernel(kc, packedA + ir * kc, b,
+                                   C + (ic + ir) * ldc + jc + jr, ldc, mr, nr, alpha);
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    freeDoubles(packedB, kcMax * ncMax);
+}
+
+} // namespace detail
+} // namespace MatrixLib
@@ -0,0 +1,46 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_GEMM_H
+#define MATRIXLIB_GEMM_H
+
+#include <cstddef>  // for size_t
+
+namespace MatrixLib {
+namespace detail {
+
+// ===== GEMM Engine =====
+//
+// Blocked general matrix multiply on row-major buffers:
+//
+//     C = alpha * op(A) * op(B) + beta * C
+//
+// op(A) is M x K, op(B) is K x N and C is M x N. op(X) is X or its transpose.
+// lda/ldb/ldc are the row strides (leading dimensions) of the stored buffers.
+// Panels of A and B are packed into contiguous slivers sized for the cache
+// hierarchy and fed to a register-blocked MR x NR microkernel (AVX-512, AVX2
+// or portable, picked once from CPUID; all give the same bits).
+
+// register tile of the microkernel (rows x cols of C kept in registers)
+constexpr std::size_t GEMM_MR = 4;
+constexpr std::size_t GEMM_NR = 8;
+
+// cache blocking: A block (MC x KC) in L2, B sliver (KC x NR) in L1,
+// B panel (KC x NC) in L3
+constexpr std::size_t GEMM_MC = 96;
+constexpr std::size_t GEMM_KC = 256;
+constexpr std::size_t GEMM_NC = 2048;
+
+// below this order the packing overhead outweighs the gain
+constexpr std::size_t GEMM_THRESHOLD = 64;
+
+// below this many multiply-adds (M * N * K) the product stays on one thread
+constexpr std::size_t GEMM_PAR_MIN_WORK = std::size_t(1) << 21;
+
+void gemm(std::size_t M, std::size_t N, std::size_t K, double alpha,
+          const double* A, std::size_t lda, bool transA,
+          const double* B, std::size_t ldb, bool transB,
+          double beta, double* C, std::size_t ldc);
+
+} // namespace detail
+} // namespace MatrixLib
+#endif
@@ -0,0 +1,511 @@
+// eitan.derdiger@gmail.com
+
+// sum a^2 must not fuse v * v + acc into an FMA (the avx2,fma and avx512f
+// targets have one), or the tables stop returning the same bits. clang takes
+// this for the whole file; GCC takes it per kernel (KERNELS_ATTR).
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#define KERNELS_NO_CONTRACT
+#elif defined(__GNUC__)
+#define KERNELS_NO_CONTRACT optimize("fp-contract=off")
+#endif
+
+#ifdef KERNELS_NO_CONTRACT
+#define KERNELS_ATTR(ISA) __attribute__((target(ISA), KERNELS_NO_CONTRACT))
+#define SCALAR_ATTR __attribute__((KERNELS_NO_CONTRACT))
+#else
+#define KERNELS_ATTR(ISA) __attribute__((target(ISA)))
+#define SCALAR_ATTR
+#endif
+
+#include "Kernels.h"
+#include <stdexcept>  // for invalid_argument
+#include <limits>     // for infinity
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIXLIB_X86 1
+#include <immintrin.h>
+#endif
+
+namespace MatrixLib {
+namespace detail {
+
+namespace {
+
+constexpr std::size_t LANES = 16;  // accumulator lanes used by every sum kernel
+
+// Fold the 16 lanes in a fixed tree order: l + (l+8), then +4, +2, +1
+double foldLanes(double* lanes) {
+    for (std::size_t w = LANES / 2; w > 0; w /= 2)
+        for (std::size_t l = 0; l < w; ++l)
+            lanes[l] += lanes[l + w];
+    return lanes[0];
+}
+
+// Add the elements past the last full 16-block into their lanes
+void sumTail(const double* a, std::size_t i, std::size_t len, double* lanes) {
+    for (std::size_t l = 0; i < len; ++i, ++l)
+        lanes[l] += a[i];
+}
+
+// One Kahan step on a lane (the SIMD kernels run the same steps per register)
+inline void kahanStep(double& s, double& c, double x) {
+    double y = x - c;
+    double t = s + y;
+    c = (t - s) - y;
+    s = t;
+}
+
+// Finish a compensated sum: tail elements into their lanes, then fold the
+// lanes (s[l] - c[l]) with one more compensated pass in lane order
+double kahanFinish(const double* a, std::size_t i, std::size_t len, double* s, double* c) {
+    for (std::size_t l = 0; i < len; ++i, ++l)
+        kahanStep(s[l], c[l], a[i]);
+    double sum = 0, comp = 0;
+    for (std::size_t l = 0; l < LANES; ++l) {
+        kahanStep(sum, comp, s[l]);
+        kahanStep(sum, comp, -c[l]);
+    }
+    return sum;
+}
+
+// Finish row statistics: tail elements into their lanes, then fold
+SCALAR_ATTR void statsFinish(const double* a, std::size_t i, std::size_t len, double* sa, double* sq,
+                 double* mn, double* mx, RowStats& out) {
+    for (std::size_t l = 0; i < len; ++i, ++l) {
+        double v = a[i];
+        sa[l] += v < 0 ? -v : v;
+        sq[l] += v * v;
+        mn[l] = mn[l] < v ? mn[l] : v;
+        mx[l] = mx[l] > v ? mx[l] : v;
+    }
+    out.sumAbs = foldLanes(sa);
+    out.sumSq = foldLanes(sq);
+    out.min = mn[0];
+    out.max = mx[0];
+    for (std::size_t l = 1; l < LANES; ++l) {
+        out.min = out.min < mn[l] ? out.min : mn[l];
+        out.max = out.max > mx[l] ? out.max : mx[l];
+    }
+}
+
+// Scalar transpose of src rows [r0, r1) x cols [c0, c1) (the tails of the SIMD tiles)
+void transposeEdge(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                   std::size_t r0, std::size_t r1, std::size_t c0, std::size_t c1) {
+    for (std::size_t i = r0; i < r1; ++i)
+        for (std::size_t j = c0; j < c1; ++j)
+            dst[j * ldd + i] = src[i * lds + j];
+}
+
+#ifndef MATRIXLIB_X86
+
+// ======= Portable Scalar Kernels =======
+
+void addScalarLoop(const double* a, const double* b, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = a[i] + b[i];
+}
+void subScalarLoop(const double* a, const double* b, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = a[i] - b[i];
+}
+void mulScalarLoop(const double* a, const double* b, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = a[i] * b[i];
+}
+void scaleScalarLoop(const double* a, double s, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = s * a[i];
+}
+void divScalarLoop(const double* a, double s, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = a[i] / s;
+}
+void negScalarLoop(const double* a, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = -a[i];
+}
+void addsScalarLoop(const double* a, double s, double* out, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) out[i] = a[i] + s;
+}
+void transposeScalarLoop(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                         std::size_t rows, std::size_t cols) {
+    transposeEdge(src, lds, dst, ldd, 0, rows, 0, cols);
+}
+double sumScalarLoop(const double* a, std::size_t len) {
+    double lanes[LANES] = {};
+    std::size_t i = 0;
+    for (; i + LANES <= len; i += LANES)
+        for (std::size_t l = 0; l < LANES; ++l)
+            lanes[l] += a[i + l];
+    sumTail(a, i, len, lanes);
+    return foldLanes(lanes);
+}
+
+double sumKahanScalarLoop(const double* a, std::size_t len) {
+    double s[LANES] = {}, c[LANES] = {};
+    std::size_t i = 0;
+    for (; i + LANES <= len; i += LANES)
+        for (std::size_t l = 0; l < LANES; ++l)
+            kahanStep(s[l], c[l], a[i + l]);
+    return kahanFinish(a, i, len, s, c);
+}
+void statsScalarLoop(const double* a, std::size_t len, RowStats& out) {
+    double sa[LANES] = {}, sq[LANES] = {}, mn[LANES], mx[LANES];
+    for (std::size_t l = 0; l < LANES; ++l) {
+        mn[l] = std::numeric_limits<double>::infinity();
+        mx[l] = -std::numeric_limits<double>::infinity();
+    }
+    statsFinish(a, 0, len, sa, sq, mn, mx, out);
+}
+void addAbsScalarLoop(const double* a, double* acc, std::size_t len) {
+    for (std::size_t i = 0; i < len; ++i) acc[i] += a[i] < 0 ? -a[i] : a[i];
+}
+
+// non-x86 builds: the baseline slot runs the portable loops
+const KernelTable SSE2_TABLE = {
+    "scalar", addScalarLoop, subScalarLoop, mulScalarLoop, scaleScalarLoop,
+    divScalarLoop, negScalarLoop, addsScalarLoop, sumScalarLoop, sumKahanScalarLoop,
+    statsScalarLoop, addAbsScalarLoop, transposeScalarLoop};
+
+#else
+
+// Element-wise kernel bodies shared by every instruction set.
+// W = doubles per register, OP = combine two registers.
+#define MATRIXLIB_BINARY_KERNEL(NAME, ATTR, W, LOAD, STORE, OP, SCALAR_OP)          \
+    ATTR void NAME(const double* a, const double* b, double* out, std::size_t len) { \
+        std::size_t i = 0;                                                           \
+        for (; i + W <= len; i += W)                                                 \
+            STORE(out + i, OP(LOAD(a + i), LOAD(b + i)));                            \
+        for (; i < len; ++i) out[i] = a[i] SCALAR_OP b[i];                           \
+    }
+
+#define MATRIXLIB_SCALAR_KERNEL(NAME, ATTR, W, LOAD, STORE, SET1, EXPR, SCALAR_EXPR) \
+    ATTR void NAME(const double* a, double s, double* out, std::size_t len) {        \
+        std::size_t i = 0;                                                           \
+        auto vs = SET1(s);                                                           \
+        for (; i + W <= len; i += W) {                                               \
+            auto va = LOAD(a + i);                                                   \
+            STORE(out + i, EXPR);                                                    \
+        }                                                                            \
+        for (; i < len; ++i) out[i] = SCALAR_EXPR;                                   \
+    }
+
+// Reduction kernel bodies shared by every instruction set: LANES / W registers
+// per accumulator, stored to 16 lanes and finished by the scalar helpers.
+#define MATRIXLIB_REDUCE_KERNELS(SFX, ATTR, W, VT, LOAD, STORE, ZERO, SET1, ADD, SUB, MUL, MIN, MAX, ABS) \
+    ATTR double sumKahan##SFX(const double* a, std::size_t len) {                     \
+        VT s[LANES / W], c[LANES / W];                                                 \
+        for (std::size_t r = 0; r < LANES / W; ++r) s[r] = c[r] = ZERO();              \
+        std::size_t i = 0;                                                             \
+        for (; i + LANES <= len; i += LANES)                                           \
+            for (std::size_t r = 0; r < LANES / W; ++r) {                              \
+                VT y = SUB(LOAD(a + i + W * r), c[r]);                                 \
+                VT t = ADD(s[r], y);                                                   \
+                c[r] = SUB(SUB(t, s[r]), y);                                           \
+                s[r] = t;                                                              \
+            }                                                                          \
+        double ls[LANES], lc[LANES];                                                   \
+        for (std::size_t r = 0; r < LANES / W; ++r) {                                  \
+            STORE(ls + W * r, s[r]);                                                   \
+            STORE(lc + W * r, c[r]);                                                   \
+        }                                                                              \
+        return kahanFinish(a, i, len, ls, lc);                                         \
+    }                                                                                  \
+    ATTR void stats##SFX(const double* a, std::size_t len, RowStats& out) {           \
+        VT sa[LANES / W], sq[LANES / W], mn[LANES / W], mx[LANES / W];                 \
+        for (std::size_t r = 0; r < LANES / W; ++r) {                                  \
+            sa[r] = sq[r] = ZERO();                                                    \
+            mn[r] = SET1(std::numeric_limits<double>::infinity());                     \
+            mx[r] = SET1(-std::numeric_limits<double>::infinity());                    \
+        }                                                                              \
+        std::size_t i = 0;                                                             \
+        for (; i + LANES <= len; i += LANES)                                           \
+            for (std::size_t r = 0; r < LANES / W; ++r) {                              \
+                VT v = LOAD(a + i + W * r);                                            \
+                sa[r] = ADD(sa[r], ABS(v));                                            \
+                sq[r] = ADD(sq[r], MUL(v, v));                                         \
+                mn[r] = MIN(mn[r], v);                                                 \
+                mx[r] = MAX(mx[r], v);                                                 \
+            }                                                                          \
+        double lsa[LANES], lsq[LANES], lmn[LANES], lmx[LANES];                         \
+        for (std::size_t r = 0; r < LANES / W; ++r) {                                  \
+            STORE(lsa + W * r, sa[r]);                                                 \
+            STORE(lsq + W * r, sq[r]);                                                 \
+            STORE(lmn + W * r, mn[r]);                                                 \
+            STORE(lmx + W * r, mx[r]);                                                 \
+        }                                                                              \
+        statsFinish(a, i, len, lsa, lsq, lmn, lmx, out);                               \
+    }                                                                                  \
+    ATTR void addAbs##SFX(const double* a, double* acc, std::size_t len) {            \
+        std::size_t i = 0;                                                             \
+        for (; i + W <= len; i += W)                                                   \
+            STORE(acc + i, ADD(LOAD(acc + i), ABS(LOAD(a + i))));                      \
+        for (; i < len; ++i) acc[i] += a[i] < 0 ? -a[i] : a[i];                        \
+    }
+
+// ======= SSE2 Kernels =======
+
+#define SSE2_ATTR KERNELS_ATTR("sse2")
+
+MATRIXLIB_BINARY_KERNEL(addSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, +)
+MATRIXLIB_BINARY_KERNEL(subSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, -)
+MATRIXLIB_BINARY_KERNEL(mulSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, *)
+MATRIXLIB_SCALAR_KERNEL(scaleSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+                        _mm_mul_pd(vs, va), s * a[i])
+MATRIXLIB_SCALAR_KERNEL(divSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+                        _mm_div_pd(va, vs), a[i] / s)
+MATRIXLIB_SCALAR_KERNEL(addsSse2, SSE2_ATTR, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+                        _mm_add_pd(va, vs), a[i] + s)
+
+SSE2_ATTR void negSse2(const double* a, double* out, std::size_t len) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    std::size_t i = 0;
+    for (; i + 2 <= len; i += 2)
+        _mm_storeu_pd(out + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    for (; i < len; ++i) out[i] = -a[i];
+}
+
+SSE2_ATTR double sumSse2(const double* a, std::size_t len) {
+    __m128d acc[LANES / 2];
+    for (auto& r : acc) r = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + LANES <= len; i += LANES)
+        for (std::size_t r = 0; r < LANES / 2; ++r)
+            acc[r] = _mm_add_pd(acc[r], _mm_loadu_pd(a + i + 2 * r));
+    double lanes[LANES];
+    for (std::size_t r = 0; r < LANES / 2; ++r)
+        _mm_storeu_pd(lanes + 2 * r, acc[r]);
+    sumTail(a, i, len, lanes);
+    return foldLanes(lanes);
+}
+
+SSE2_ATTR inline __m128d absSse2(__m128d v) { return _mm_andnot_pd(_mm_set1_pd(-0.0), v); }
+MATRIXLIB_REDUCE_KERNELS(Sse2, SSE2_ATTR, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_setzero_pd,
+                         _mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_min_pd, _mm_max_pd, absSse2)
+
+// 2x2 tiles: unpack the two rows into the two columns
+SSE2_ATTR void transposeSse2(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                             std::size_t rows, std::size_t cols) {
+    std::size_t R = rows & ~std::size_t(1), C = cols & ~std::size_t(1);
+    for (std::size_t i = 0; i < R; i += 2)
+        for (std::size_t j = 0; j < C; j += 2) {
+            __m128d r0 = _mm_loadu_pd(src + i * lds + j);
+            __m128d r1 = _mm_loadu_pd(src + (i + 1) * lds + j);
+            _mm_storeu_pd(dst + j * ldd + i, _mm_unpacklo_pd(r0, r1));
+            _mm_storeu_pd(dst + (j + 1) * ldd + i, _mm_unpackhi_pd(r0, r1));
+        }
+    transposeEdge(src, lds, dst, ldd, 0, R, C, cols);
+    transposeEdge(src, lds, dst, ldd, R, rows, 0, cols);
+}
+
+// ======= AVX2 Kernels =======
+
+#define AVX2_ATTR KERNELS_ATTR("avx2,fma")
+
+MATRIXLIB_BINARY_KERNEL(addAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, +)
+MATRIXLIB_BINARY_KERNEL(subAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, -)
+MATRIXLIB_BINARY_KERNEL(mulAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, *)
+MATRIXLIB_SCALAR_KERNEL(scaleAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                        _mm256_mul_pd(vs, va), s * a[i])
+MATRIXLIB_SCALAR_KERNEL(divAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                        _mm256_div_pd(va, vs), a[i] / s)
+MATRIXLIB_SCALAR_KERNEL(addsAvx2, AVX2_ATTR, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                        _mm256_add_pd(va, vs), a[i] + s)
+
+AVX2_ATTR void negAvx2(const double* a, double* out, std::size_t len) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    std::size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    for (; i < len; ++i) out[i] = -a[i];
+}
+
+AVX2_ATTR double sumAvx2(const double* a, std::size_t len) {
+    __m256d acc[LANES / 4];
+    for (auto& r : acc) r = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + LANES <= len; i += LANES)
+        for (std::size_t r = 0; r < LANES / 4; ++r)
+            acc[r] = _mm256_add_pd(acc[r], _mm256_loadu_pd(a + i + 4 * r));
+    double lanes[LANES];
+    for (std::size_t r = 0; r < LANES / 4; ++r)
+        _mm256_storeu_pd(lanes + 4 * r, acc[r]);
+    sumTail(a, i, len, lanes);
+    return foldLanes(lanes);
+}
+
+AVX2_ATTR inline __m256d absAvx2(__m256d v) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v); }
+MATRIXLIB_REDUCE_KERNELS(Avx2, AVX2_ATTR, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_setzero_pd,
+                         _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_min_pd,
+                         _mm256_max_pd, absAvx2)
+
+// 4x4 tiles: unpack row pairs, then swap 128-bit halves
+AVX2_ATTR void transposeAvx2(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                             std::size_t rows, std::size_t cols) {
+    std::size_t R = rows & ~std::size_t(3), C = cols & ~std::size_t(3);
+    for (std::size_t i = 0; i < R; i += 4)
+        for (std::size_t j = 0; j < C; j += 4) {
+            const double* s = src + i * lds + j;
+            __m256d r0 = _mm256_loadu_pd(s);
+            __m256d r1 = _mm256_loadu_pd(s + lds);
+            __m256d r2 = _mm256_loadu_pd(s + 2 * lds);
+            __m256d r3 = _mm256_loadu_pd(s + 3 * lds);
+            __m256d t0 = _mm256_unpacklo_pd(r0, r1);   // r0[0] r1[0] r0[2] r1[2]
+            __m256d t1 = _mm256_unpackhi_pd(r0, r1);   // r0[1] r1[1] r0[3] r1[3]
+            __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+            __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+            double* d = dst + j * ldd + i;
+            _mm256_storeu_pd(d,           _mm256_permute2f128_pd(t0, t2, 0x20));
+            _mm256_storeu_pd(d + ldd,     _mm256_permute2f128_pd(t1, t3, 0x20));
+            _mm256_storeu_pd(d + 2 * ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+            _mm256_storeu_pd(d + 3 * ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+        }
+    transposeEdge(src, lds, dst, ldd, 0, R, C, cols);
+    transposeEdge(src, lds, dst, ldd, R, rows, 0, cols);
+}
+
+// ======= AVX-512 Kernels =======
+
+#define AVX512_ATTR KERNELS_ATTR("avx512f")
+
+MATRIXLIB_BINARY_KERNEL(addAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, +)
+MATRIXLIB_BINARY_KERNEL(subAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_sub_pd, -)
+MATRIXLIB_BINARY_KERNEL(mulAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd, *)
+MATRIXLIB_SCALAR_KERNEL(scaleAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+                        _mm512_mul_pd(vs, va), s * a[i])
+MATRIXLIB_SCALAR_KERNEL(divAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+                        _mm512_div_pd(va, vs), a[i] / s)
+MATRIXLIB_SCALAR_KERNEL(addsAvx512, AVX512_ATTR, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+                        _mm512_add_pd(va, vs), a[i] + s)
+
+AVX512_ATTR void negAvx512(const double* a, double* out, std::size_t len) {
+    // avx512f has no xor_pd, so flip the sign bit through the integer view
+    const __m512i sign = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL));
+    std::size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m512i v = _mm512_castpd_si512(_mm512_loadu_pd(a + i));
+        _mm512_storeu_pd(out + i, _mm512_castsi512_pd(_mm512_xor_epi64(v, sign)));
+    }
+    for (; i < len; ++i) out[i] = -a[i];
+}
+
+AVX512_ATTR double sumAvx512(const double* a, std::size_t len) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + LANES <= len; i += LANES) {
+        acc0 = _mm512_add_pd(acc0, _mm512_loadu_pd(a + i));
+        acc1 = _mm512_add_pd(acc1, _mm512_loadu_pd(a + i + 8));
+    }
+    double lanes[LANES];
+    _mm512_storeu_pd(lanes, acc0);
+    _mm512_storeu_pd(lanes + 8, acc1);
+    sumTail(a, i, len, lanes);
+    return foldLanes(lanes);
+}
+
+// full-mask forms (the plain min/max trip the same GCC false positive)
+AVX512_ATTR inline __m512d minAvx512(__m512d a, __m512d b) { return _mm512_mask_min_pd(a, 0xFF, a, b); }
+AVX512_ATTR inline __m512d maxAvx512(__m512d a, __m512d b) { return _mm512_mask_max_pd(a, 0xFF, a, b); }
+MATRIXLIB_REDUCE_KERNELS(Avx512, AVX512_ATTR, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_setzero_pd,
+                         _mm512_set1_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, minAvx512,
+                         maxAvx512, _mm512_abs_pd)
+
+// 8x8 tiles: interleave row pairs, gather 2x2 blocks into 4-row groups, then
+// join the upper and lower groups. Every step is a two-source permute
+// (unpack*_pd trips a GCC uninitialized-value false positive here).
+AVX512_ATTR void transposeAvx512(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                                 std::size_t rows, std::size_t cols) {
+    const __m512i even = _mm512_set_epi64(14, 6, 12, 4, 10, 2, 8, 0);
+    const __m512i odd  = _mm512_set_epi64(15, 7, 13, 5, 11, 3, 9, 1);
+    const __m512i lo2 = _mm512_set_epi64(13, 12, 5, 4, 9, 8, 1, 0);
+    const __m512i hi2 = _mm512_set_epi64(15, 14, 7, 6, 11, 10, 3, 2);
+    const __m512i lo4 = _mm512_set_epi64(11, 10, 9, 8, 3, 2, 1, 0);
+    const __m512i hi4 = _mm512_set_epi64(15, 14, 13, 12, 7, 6, 5, 4);
+    std::size_t R = rows & ~std::size_t(7), C = cols & ~std::size_t(7);
+    for (std::size_t i = 0; i < R; i += 8)
+        for (std::size_t j = 0; j < C; j += 8) {
+            const double* s = src + i * lds + j;
+            __m512d r[8], t[8];
+            for (int k = 0; k < 8; ++k)
+                r[k] = _mm512_loadu_pd(s + k * lds);
+            for (int k = 0; k < 8; k += 2) {
+                t[k]     = _mm512_permutex2var_pd(r[k], even, r[k + 1]);  // even columns
+                t[k + 1] = _mm512_permutex2var_pd(r[k], odd, r[k + 1]);   // odd columns
+            }
+            // u: rows 0-3, v: rows 4-7; each register holds two columns (c, c+4)
+            __m512d u0 = _mm512_permutex2var_pd(t[0], lo2, t[2]);  // cols 0, 4
+            __m512d u1 = _mm512_permutex2var_pd(t[0], hi2, t[2]);  // cols 2, 6
+            __m512d u2 = _mm512_permutex2var_pd(t[1], lo2, t[3]);  // cols 1, 5
+            __m512d u3 = _mm512_permutex2var_pd(t[1], hi2, t[3]);  // cols 3, 7
+            __m512d v0 = _mm512_permutex2var_pd(t[4], lo2, t[6]);
+            __m512d v1 = _mm512_permutex2var_pd(t[4], hi2, t[6]);
+            __m512d v2 = _mm512_permutex2var_pd(t[5], lo2, t[7]);
+            __m512d v3 = _mm512_permutex2var_pd(t[5], hi2, t[7]);
+            double* d = dst + j * ldd + i;
+            _mm512_storeu_pd(d,           _mm512_permutex2var_pd(u0, lo4, v0));
+            _mm512_storeu_pd(d + 1 * ldd, _mm512_permutex2var_pd(u2, lo4, v2));
+            _mm512_storeu_pd(d + 2 * ldd, _mm512_permutex2var_pd(u1, lo4, v1));
+            _mm512_storeu_pd(d + 3 * ldd, _mm512_permutex2var_pd(u3, lo4, v3));
+            _mm512_storeu_pd(d + 4 * ldd, _mm512_permutex2var_pd(u0, hi4, v0));
+            _mm512_storeu_pd(d + 5 * ldd, _mm512_permutex2var_pd(u2, hi4, v2));
+            _mm512_storeu_pd(d + 6 * ldd, _mm512_permutex2var_pd(u1, hi4, v1));
+            _mm512_storeu_pd(d + 7 * ldd, _mm512_permutex2var_pd(u3, hi4, v3));
+        }
+    transposeEdge(src, lds, dst, ldd, 0, R, C, cols);
+    transposeEdge(src, lds, dst, ldd, R, rows, 0, cols);
+}
+
+#undef MATRIXLIB_BINARY_KERNEL
+#undef MATRIXLIB_SCALAR_KERNEL
+#undef MATRIXLIB_REDUCE_KERNELS
+#undef SSE2_ATTR
+#undef AVX2_ATTR
+#undef AVX512_ATTR
+
+const KernelTable SSE2_TABLE = {
+    "sse2", addSse2, subSse2, mulSse2, scaleSse2, divSse2, negSse2, addsSse2, sumSse2,
+    sumKahanSse2, statsSse2, addAbsSse2, transposeSse2};
+const KernelTable AVX2_TABLE = {
+    "avx2", addAvx2, subAvx2, mulAvx2, scaleAvx2, divAvx2, negAvx2, addsAvx2, sumAvx2,
+    sumKahanAvx2, statsAvx2, addAbsAvx2, transposeAvx2};
+const KernelTable AVX512_TABLE = {
+    "avx512", addAvx512, subAvx512, mulAvx512, scaleAvx512, divAvx512, negAvx512, addsAvx512, sumAvx512,
+    sumKahanAvx512, statsAvx512, addAbsAvx512, transposeAvx512};
+
+#endif
+
+} // namespace
+
+#undef KERNELS_ATTR
+#undef SCALAR_ATTR
+#undef KERNELS_NO_CONTRACT
+
+bool isaSupported(Isa isa) {
+#ifdef MATRIXLIB_X86
+    switch (isa) {
+    case Isa::SSE2:   return true;
+    case Isa::AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case Isa::AVX512: return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#else
+    return isa == Isa::SSE2;
+#endif
+}
+
+const KernelTable& kernelTable(Isa isa) {
+    if (!isaSupported(isa))
+        throw std::invalid_argument("instruction set not supported");
+#ifdef MATRIXLIB_X86
+    if (isa == Isa::AVX512) return AVX512_TABLE;
+    if (isa == Isa::AVX2) return AVX2_TABLE;
+#endif
+    return SSE2_TABLE;
+}
+
+const KernelTable& kernels() {
+    static const KernelTable& best =
+        isaSupported(Isa::AVX512) ? kernelTable(Isa::AVX512) :
+        isaSupported(Isa::AVX2)   ? kernelTable(Isa::AVX2)   :
+                                    kernelTable(Isa::SSE2);
+    return best;
+}
+
+} // namespace detail
+} // namespace MatrixLib
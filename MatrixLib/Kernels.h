@@ -0,0 +1,70 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_KERNELS_H
+#define MATRIXLIB_KERNELS_H
+
+#include <cstddef>  // for size_t
+
+namespace MatrixLib {
+namespace detail {
+
+// ===== Element-wise SIMD Kernels =====
+//
+// One table per instruction set. The best table the CPU supports is picked
+// once (CPUID) on first use, so a single binary runs at full vector width on
+// every host. Element-wise kernels produce bit-identical results on every
+// table, and out may alias either input.
+
+enum class Isa { SSE2, AVX2, AVX512 };
+
+// one-pass statistics of a row (see KernelTable::stats)
+struct RowStats {
+    double sumAbs;   // sum of |a|
+    double sumSq;    // sum of a^2
+    double min;
+    double max;
+};
+
+struct KernelTable {
+    const char* name;
+
+    void (*add)(const double* a, const double* b, double* out, std::size_t len);   // a + b
+    void (*sub)(const double* a, const double* b, double* out, std::size_t len);   // a - b
+    void (*mul)(const double* a, const double* b, double* out, std::size_t len);   // a * b (Hadamard)
+    void (*scale)(const double* a, double s, double* out, std::size_t len);        // a * s
+    void (*div)(const double* a, double s, double* out, std::size_t len);          // a / s
+    void (*neg)(const double* a, double* out, std::size_t len);                    // -a
+    void (*addScalar)(const double* a, double s, double* out, std::size_t len);    // a + s
+
+    // Sum of a[0..len). Always accumulates into 16 lanes that are folded in a
+    // fixed order, so every table returns the same bits for the same input.
+    double (*sum)(const double* a, std::size_t len);
+
+    // Kahan-compensated sum of a[0..len): 16 compensated lanes, folded in a fixed order
+    double (*sumKahan)(const double* a, std::size_t len);
+
+    // sum |a|, sum a^2, min and max of a[0..len) in one pass (len > 0).
+    // Same 16-lane layout, so every table returns the same bits.
+    void (*stats)(const double* a, std::size_t len, RowStats& out);
+
+    // acc[i] += |a[i]|
+    void (*addAbs)(const double* a, double* acc, std::size_t len);
+
+    // dst[j * ldd + i] = src[i * lds + j] for a rows x cols block, using
+    // in-register 2x2 / 4x4 / 8x8 tile shuffles (dst must not overlap src)
+    void (*transpose)(const double* src, std::size_t lds, double* dst, std::size_t ldd,
+                      std::size_t rows, std::size_t cols);
+};
+
+// true if this CPU (and build target) can run the given table
+bool isaSupported(Isa isa);
+
+// table for a specific instruction set (must be supported)
+const KernelTable& kernelTable(Isa isa);
+
+// best supported table, chosen once on first call
+const KernelTable& kernels();
+
+} // namespace detail
+} // namespace MatrixLib
+#endif
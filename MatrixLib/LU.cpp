@@ -0,0 +1,316 @@
+// eitan.derdiger@gmail.com
+
+#include "LU.h"
+#include "ThreadPool.h"
+#include "Gemm.h"
+#include "TaskGraph.h"
+#include "Alloc.h"
+#include <algorithm>   // for std::swap, std::swap_ranges, std::copy, std::min
+#include <cmath>       // for fabs, log
+#include <limits>      // for infinity
+#include <atomic>      // for atomic
+
+using namespace MatrixLib;
+
+namespace {
+
+using detail::PAR_GRAIN;
+
+// columns per panel in the blocked factorization
+constexpr std::size_t LU_NB = 64;
+
+// below this order the whole matrix is one panel (plain elimination)
+constexpr std::size_t LU_BLOCK_MIN = 2 * detail::GEMM_THRESHOLD;
+
+// Columns of the right-hand side substituted together: the band of X being
+// updated stays in cache while the factor streams past it once, and the inner
+// loops run over contiguous elements
+constexpr std::size_t SOLVE_BAND = 64;
+
+// columns of the right-hand side handled by one pool task (whole bands)
+std::size_t solveGrain(std::size_t n) {
+    std::size_t g = PAR_GRAIN / (n * n);
+    return g > SOLVE_BAND ? g : SOLVE_BAND;
+}
+
+} // namespace
+
+// ======= Factorization =======
+
+// Factor the panel of columns [k, k + nb) over rows [k, n). Row swaps stay
+// inside the panel (other columns catch up later) and are recorded in ipiv.
+// Returns false on a pivot below EPS.
+bool LU::factorPanel(std::size_t k, std::size_t nb, std::size_t* ipiv) {
+    std::size_t end = k + nb;
+    for (std::size_t i = k; i < end; ++i) {
+        // Find the row with the largest pivot (for numerical stability)
+        std::size_t max_row = i;
+        for (std::size_t j = i + 1; j < n; ++j)
+            if (std::fabs(lu[j * ld + i]) > std::fabs(lu[max_row * ld + i]))
+                max_row = j;
+
+        ipiv[i] = max_row;
+        if (i != max_row)
+            std::swap_ranges(lu + i * ld + k, lu + i * ld + end, lu + max_row * ld + k);
+
+        // If the pivot is basically zero the matrix is singular
+        double p = lu[i * ld + i];
+        if (std::fabs(p) < SquareMat::EPS) return false;
+
+        // Eliminate below the pivot (rows are independent, so split them over the pool)
+        const double* rowI = lu + i * ld;
+        std::size_t rows = n - i - 1;
+        ThreadPool::instance().parallelFor(rows, PAR_GRAIN / (end - i), [&](std::size_t r0, std::size_t r1) {
+            for (std::size_t j = i + 1 + r0; j < i + 1 + r1; ++j) {
+                double* rowJ = lu + j * ld;
+                double factor = rowJ[i] / p;
+                for (std::size_t c = i + 1; c < end; ++c)
+                    rowJ[c] -= factor * rowI[c];
+                rowJ[i] = factor;
+            }
+        });
+    }
+    return true;
+}
+
+// Bring columns [c0, c0 + w) up to date with panel k: apply its row swaps,
+// solve for the U block (unit lower triangular solve), then fold the panel
+// into the rows below with one GEMM, A22 -= L21 * U12
+void LU::updateTile(std::size_t k, std::size_t nb, std::size_t c0, std::size_t w,
+                    const std::size_t* ipiv) {
+    std::size_t k2 = k + nb;
+    for (std::size_t i = k; i < k2; ++i)
+        if (ipiv[i] != i)
+            std::swap_ranges(lu + i * ld + c0, lu + i * ld + c0 + w, lu + ipiv[i] * ld + c0);
+
+    for (std::size_t i = k + 1; i < k2; ++i) {
+        double* ri = lu + i * ld + c0;
+        for (std::size_t p = k; p < i; ++p) {
+            double l = lu[i * ld + p];
+            const double* rp = lu + p * ld + c0;
+            for (std::size_t c = 0; c < w; ++c) ri[c] -= l * rp[c];
+        }
+    }
+
+    if (k2 < n)
+        detail::gemm(n - k2, w, nb, -1.0,
+                     lu + k2 * ld + k, ld, false,
+                     lu + k * ld + c0, ld, false,
+                     1.0, lu + k2 * ld + c0, ld);
+}
+
+// Tiled right-looking LU on column tiles of LU_NB. Task P(k) factors panel k;
+// task U(k, j) updates tile j with panel k. The graph
+//
+//     P(k)      after U(k-1, k)
+//     U(k, j)   after P(k) and U(k-1, j)
+//
+// lets P(k+1) start as soon as its own tile is updated, while the rest of
+// step k's updates are still running (lookahead), so the panel chain is
+// overlapped with the GEMM work. Each tile sees its updates in the same
+// order on any thread count, so the factors do not depend on scheduling.
+LU::LU(const SquareMat& A)
+    : n(A.n), ld(detail::paddedStride(A.n)), lu(nullptr), piv(nullptr), sign(1), singular(false) {
+    if (n == 0) throw std::logic_error("LU of empty matrix");
+    lu = detail::allocDoubles(n * ld);
+    piv = new std::size_t[n];
+    for (std::size_t i = 0; i < n; ++i)
+        std::copy(A.elems + i * n, A.elems + i * n + n, lu + i * ld);
+
+    // ipiv[i]: row swapped with row i at step i (LAPACK style)
+    std::size_t* ipiv = new std::size_t[n];
+    for (std::size_t i = 0; i < n; ++i) ipiv[i] = i;
+
+    std::size_t NB = n < LU_BLOCK_MIN ? n : LU_NB;
+    std::size_t T = (n + NB - 1) / NB;
+    if (T == 1) {
+        singular = !factorPanel(0, n, ipiv);
+    } else {
+        // task ids: step k owns P(k) followed by U(k, k+1) .. U(k, T-1)
+        auto id = [T](std::size_t k, std::size_t j) { return k * T - k * (k - 1) / 2 + (j - k); };
+        TaskGraph g(T * (T + 1) / 2);
+        for (std::size_t k = 0; k < T; ++k) {
+            if (k > 0) g.depend(id(k - 1, k), id(k, k));
+            for (std::size_t j = k + 1; j < T; ++j) {
+                g.depend(id(k, k), id(k, j));
+                if (k > 0) g.depend(id(k - 1, j), id(k, j));
+            }
+        }
+
+        std::atomic<bool> stop{false};  // a singular panel cancels what is left
+        g.run([&](std::size_t t) {
+            if (stop.load()) return;
+            std::size_t k = 0;
+            while (t >= T - k) { t -= T - k; ++k; }   // invert id(k, j)
+            std::size_t j = k + t;
+            std::size_t r0 = k * NB, nb = std::min(NB, n - r0);
+            if (j == k) {
+                if (!factorPanel(r0, nb, ipiv)) stop.store(true);
+            } else {
+                std::size_t c0 = j * NB;
+                updateTile(r0, nb, c0, std::min(NB, n - c0), ipiv);
+            }
+        });
+        singular = stop.load();
+
+        // panels swapped only their own columns: catch up the L blocks on the left
+        if (!singular)
+            for (std::size_t i = NB; i < n; ++i)
+                if (ipiv[i] != i)
+                    std::swap_ranges(lu + i * ld, lu + i * ld + i / NB * NB, lu + ipiv[i] * ld);
+    }
+
+    // pivot vector and parity from the swap sequence
+    for (std::size_t i = 0; i < n; ++i) piv[i] = i;
+    for (std::size_t i = 0; i < n; ++i)
+        if (ipiv[i] != i) {
+            std::swap(piv[i], piv[ipiv[i]]);
+            sign = -sign;
+        }
+    delete[] ipiv;
+}
+
+// ======= Rule of Five =======
+
+LU::LU(const LU& other)
+    : n(other.n), ld(other.ld), lu(detail::allocDoubles(other.n * other.ld)),
+      piv(new std::size_t[other.n]), sign(other.sign), singular(other.singular) {
+    std::copy(other.lu, other.lu + n * ld, lu);
+    std::copy(other.piv, other.piv + n, piv);
+}
+
+LU& LU::operator=(const LU& other) {
+    if (this != &other) {
+        LU tmp(other);
+        std::swap(n, tmp.n);
+        std::swap(ld, tmp.ld);
+        std::swap(lu, tmp.lu);
+        std::swap(piv, tmp.piv);
+        std::swap(sign, tmp.sign);
+        std::swap(singular, tmp.singular);
+    }
+    return *this;
+}
+
+LU::LU(LU&& other) noexcept
+    : n(other.n), ld(other.ld), lu(other.lu), piv(other.piv), sign(other.sign),
+      singular(other.singular) {
+    other.n = 0;
+    other.lu = nullptr;
+    other.piv = nullptr;
+}
+
+LU& LU::operator=(LU&& other) noexcept {
+    if (this != &other) {
+        detail::freeDoubles(lu, n * ld);
+        delete[] piv;
+        n = other.n;
+        ld = other.ld;
+        lu = other.lu;
+        piv = other.piv;
+        sign = other.sign;
+        singular = other.singular;
+        other.n = 0;
+        other.lu = nullptr;
+        other.piv = nullptr;
+    }
+    return *this;
+}
+
+LU::~LU() {
+    detail::freeDoubles(lu, n * ld);
+    delete[] piv;
+}
+
+// ======= Determinant =======
+
+// sign * product of the pivots, multiplied in elimination order
+double LU::det() const {
+    if (singular) return 0;
+    double d = sign;
+    for (std::size_t i = 0; i < n; ++i)
+        d *= lu[i * ld + i];
+    if (std::fabs(d) < SquareMat::EPS) d = 0;
+    return d;
+}
+
+double LU::logAbsDet() const {
+    if (singular) return -std::numeric_limits<double>::infinity();
+    double s = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        s += std::log(std::fabs(lu[i * ld + i]));
+    return s;
+}
+
+// ======= Solves =======
+
+void LU::solve(const double* b, double* x) const {
+    if (singular) throw std::logic_error("singular matrix");
+
+    // x = P * b (through a scratch copy, so x may alias b)
+    double* y = new double[n];
+    for (std::size_t i = 0; i < n; ++i) y[i] = b[piv[i]];
+
+    // L y = P b (unit diagonal), then U x = y
+    for (std::size_t i = 0; i < n; ++i) {
+        const double* row = lu + i * ld;
+        double s = y[i];
+        for (std::size_t k = 0; k < i; ++k) s -= row[k] * y[k];
+        y[i] = s;
+    }
+    for (std::size_t i = n; i-- > 0;) {
+        const double* row = lu + i * ld;
+        double s = y[i];
+        for (std::size_t k = i + 1; k < n; ++k) s -= row[k] * y[k];
+        y[i] = s / row[i];
+    }
+    std::copy(y, y + n, x);
+    delete[] y;
+}
+
+// Row-oriented substitution, SOLVE_BAND columns of X at a time; the bands are
+// independent, so they are spread over the pool (each column sees the same
+// operations in the same order whatever the banding)
+SquareMat LU::solve(const SquareMat& B) const {
+    if (B.n != n) throw std::invalid_argument("order mismatch");
+    if (singular) throw std::logic_error("singular matrix");
+
+    SquareMat X(n, SquareMat::Uninit{});
+    for (std::size_t i = 0; i < n; ++i)
+        std::copy(B.elems + piv[i] * n, B.elems + piv[i] * n + n, X.elems + i * n);
+
+    double* x = X.elems;
+    ThreadPool::instance().parallelFor(n, solveGrain(n), [&](std::size_t b0, std::size_t b1) {
+        for (std::size_t c0 = b0; c0 < b1; c0 += SOLVE_BAND) {
+            std::size_t c1 = std::min(b1, c0 + SOLVE_BAND);
+            // forward: L Y = P B
+            for (std::size_t i = 1; i < n; ++i) {
+                double* xi = x + i * n;
+                for (std::size_t k = 0; k < i; ++k) {
+                    double l = lu[i * ld + k];
+                    const double* xk = x + k * n;
+                    for (std::size_t c = c0; c < c1; ++c) xi[c] -= l * xk[c];
+                }
+            }
+            // backward: U X = Y
+            for (std::size_t i = n; i-- > 0;) {
+                double* xi = x + i * n;
+                for (std::size_t k = i + 1; k < n; ++k) {
+                    double u = lu[i * ld + k];
+                    const double* xk = x + k * n;
+                    for (std::size_t c = c0; c < c1; ++c) xi[c] -= u * xk[c];
+                }
+                double d = lu[i * ld + i];
+                for (std::size_t c = c0; c < c1; ++c) xi[c] /= d;
+            }
+        }
+    });
+    return X;
+}
+
+SquareMat LU::inverse() const {
+    SquareMat I(n, 0.0);
+    for (std::size_t i = 0; i < n; ++i)
+        I.elems[i * n + i] = 1.0;
+    return solve(I);
+}
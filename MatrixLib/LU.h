@@ -0,0 +1,79 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_LU_H
+#define MATRIXLIB_LU_H
+
+#include <cstddef>      // for size_t
+#include "SquareMat.h"
+
+namespace MatrixLib {
+
+// ===== LU Factorization =====
+//
+// Factor once, reuse many times: P * A = L * U with partial pivoting.
+// L (unit diagonal, below) and U (on and above the diagonal) share one packed
+// n x n buffer. A pivot smaller than SquareMat::EPS marks the matrix singular
+// (the rule operator! applies from order 5 up; orders up to 4 use closed forms,
+// where only the final |det| < EPS test applies); det() is then 0 and solving
+// throws.
+// Large orders are factored in column tiles scheduled as a task graph: panel
+// factorizations, triangular solves and GEMM updates run across the pool.
+class LU {
+    std::size_t n;
+    std::size_t ld;      // row stride of lu (padded at aliasing-prone orders)
+    double* lu;          // packed L\U, row-major
+    std::size_t* piv;    // row i of the factors is row piv[i] of A
+    int sign;            // parity of the row permutation (+1 / -1)
+    bool singular;       // a pivot fell below EPS (factorization stopped there)
+
+    // pivot and eliminate columns [k, k + nb) (false if a pivot is below EPS)
+    bool factorPanel(std::size_t k, std::size_t nb, std::size_t* ipiv);
+
+    // apply panel [k, k + nb) to columns [c0, c0 + w): swaps, TRSM, GEMM update
+    void updateTile(std::size_t k, std::size_t nb, std::size_t c0, std::size_t w,
+                    const std::size_t* ipiv);
+
+public:
+    // ===== Rule of Five =====
+
+    // factor A (throws std::logic_error for an empty matrix)
+    explicit LU(const SquareMat& A);
+
+    LU(const LU& other);
+    LU& operator=(const LU& other);
+    LU(LU&& other) noexcept;
+    LU& operator=(LU&& other) noexcept;
+    ~LU();
+
+    // ===== Queries =====
+
+    [[nodiscard]] std::size_t order() const { return n; }
+    bool isSingular() const { return singular; }
+
+    // determinant (0 when singular or |det| < EPS, like operator!)
+    double det() const;
+
+    // log |det| without overflow for large orders (-inf when singular)
+    double logAbsDet() const;
+
+    // ===== Solves =====
+
+    // x = A^-1 * b for one right-hand side of length n (x may alias b)
+    void solve(const double* b, double* x) const;
+
+    // X = A^-1 * B, every column of B a right-hand side
+    SquareMat solve(const SquareMat& B) const;
+
+    // A^-1
+    SquareMat inverse() const;
+
+    // ===== Raw Factors =====
+
+    // row i of the packed factors starts at factors() + i * stride()
+    const double* factors() const { return lu; }
+    std::size_t stride() const { return ld; }
+    const std::size_t* pivots() const { return piv; }
+};
+
+} // namespace MatrixLib
+#endif
@@ -0,0 +1,261 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_MATEXPR_H
+#define MATRIXLIB_MATEXPR_H
+
+#include <cstddef>      // for size_t
+#include <algorithm>    // for std::min, std::copy
+#include <stdexcept>    // for exceptions
+#include <cmath>        // for fabs
+#include "Config.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+
+namespace MatrixLib {
+
+class SquareMat;
+
+// ===== Expression Templates =====
+//
+// Element-wise operators (+, -, %, scalar *, /, unary -) return lightweight
+// nodes instead of matrices. A whole tree is evaluated in one fused pass when
+// it is assigned to (or converted into) a SquareMat: each pool task walks its
+// range in EXPR_BLOCK-sized pieces, every node runs its SIMD kernel on the
+// piece, and intermediates never leave L1.
+//
+// Nodes keep references to their SquareMat leaves, so evaluate an expression
+// before its operands go away (don't store one in an `auto` variable).
+//
+// Every node E provides:
+//   std::size_t   order() const
+//   double        evalAt(std::size_t i) const                   // element i (row-major)
+//   const double* evalBlock(std::size_t off, std::size_t len, double* out) const
+//                 // elements [off, off+len) - written to out, or a pointer into a leaf
+//   bool          uses(const SquareMat* m) const               // is m one of the leaves?
+//   static constexpr bool reorders                            // reads other indices (transpose)
+
+namespace detail {
+
+// elements per fused evaluation step (one scratch buffer per tree level)
+constexpr std::size_t EXPR_BLOCK = 256;
+
+// elements per pool task in element-wise work
+constexpr std::size_t PAR_GRAIN = std::size_t(1) << 15;
+
+// leaves are held by reference, inner nodes by value
+template <class E> struct ExprStore { using type = const E; };
+template <> struct ExprStore<SquareMat> { using type = const SquareMat&; };
+
+// Write every element of e into dst[0..len). Safe when dst is also a leaf of e
+// as long as e does not reorder elements: each block is computed in scratch
+// before it is stored.
+template <class E>
+void evaluate(const E& e, double* dst, std::size_t len) {
+    ThreadPool::instance().parallelFor(len, PAR_GRAIN, [&](std::size_t b, std::size_t end) {
+        double buf[EXPR_BLOCK];
+        for (std::size_t off = b; off < end; off += EXPR_BLOCK) {
+            std::size_t m = std::min(EXPR_BLOCK, end - off);
+            const double* p = e.evalBlock(off, m, buf);
+            if (p != dst + off)
+                std::copy(p, p + m, dst + off);
+        }
+    });
+}
+
+struct AddOp {
+    static double apply(double a, double b) { return a + b; }
+    static void run(const double* a, const double* b, double* out, std::size_t len) {
+        kernels().add(a, b, out, len);
+    }
+};
+struct SubOp {
+    static double apply(double a, double b) { return a - b; }
+    static void run(const double* a, const double* b, double* out, std::size_t len) {
+        kernels().sub(a, b, out, len);
+    }
+};
+struct MulOp {
+    static double apply(double a, double b) { return a * b; }
+    static void run(const double* a, const double* b, double* out, std::size_t len) {
+        kernels().mul(a, b, out, len);
+    }
+};
+struct ScaleOp {
+    static double apply(double a, double s) { return s * a; }
+    static void run(const double* a, double s, double* out, std::size_t len) {
+        kernels().scale(a, s, out, len);
+    }
+};
+struct DivOp {
+    static double apply(double a, double s) { return a / s; }
+    static void run(const double* a, double s, double* out, std::size_t len) {
+        kernels().div(a, s, out, len);
+    }
+};
+
+} // namespace detail
+
+// read-only view of one row of an expression (evaluates on access)
+template <class E>
+class ExprRow {
+    const E& e;
+    std::size_t base;
+public:
+    ExprRow(const E& expr, std::size_t row) : e(expr), base(row * expr.order()) {}
+    double operator[](std::size_t col) const { return e.evalAt(base + col); }
+};
+
+// CRTP base shared by SquareMat and every expression node
+template <class E>
+class MatExpr {
+public:
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    // row access (bounds-checked like SquareMat)
+    ExprRow<E> operator[](std::size_t row) const {
+        if (MATRIXLIB_BOUNDS_CHECK && row >= self().order()) throw std::out_of_range("row");
+        return ExprRow<E>(self(), row);
+    }
+
+    // sum of all elements (evaluates the expression)
+    double sum() const;
+};
+
+// ===== Expression Nodes =====
+
+// element-wise l (op) r
+template <class Op, class L, class R>
+class BinaryExpr : public MatExpr<BinaryExpr<Op, L, R>> {
+    typename detail::ExprStore<L>::type l;
+    typename detail::ExprStore<R>::type r;
+public:
+    static constexpr bool reorders = L::reorders || R::reorders;
+
+    BinaryExpr(const L& lhs, const R& rhs) : l(lhs), r(rhs) {
+        if (l.order() != r.order())
+            throw std::invalid_argument("order mismatch");
+    }
+    std::size_t order() const { return l.order(); }
+    bool uses(const SquareMat* m) const { return l.uses(m) || r.uses(m); }
+    double evalAt(std::size_t i) const { return Op::apply(l.evalAt(i), r.evalAt(i)); }
+    const double* evalBlock(std::size_t off, std::size_t len, double* out) const {
+        double tmp[detail::EXPR_BLOCK];
+        const double* a = l.evalBlock(off, len, out);
+        const double* b = r.evalBlock(off, len, tmp);
+        Op::run(a, b, out, len);
+        return out;
+    }
+};
+
+// element-wise e (op) scalar
+template <class Op, class E>
+class ScalarExpr : public MatExpr<ScalarExpr<Op, E>> {
+    typename detail::ExprStore<E>::type e;
+    double s;
+public:
+    static constexpr bool reorders = E::reorders;
+
+    ScalarExpr(const E& expr, double scalar) : e(expr), s(scalar) {}
+    std::size_t order() const { return e.order(); }
+    bool uses(const SquareMat* m) const { return e.uses(m); }
+    double evalAt(std::size_t i) const { return Op::apply(e.evalAt(i), s); }
+    const double* evalBlock(std::size_t off, std::size_t len, double* out) const {
+        Op::run(e.evalBlock(off, len, out), s, out, len);
+        return out;
+    }
+};
+
+// element-wise -e
+template <class E>
+class NegateExpr : public MatExpr<NegateExpr<E>> {
+    typename detail::ExprStore<E>::type e;
+public:
+    static constexpr bool reorders = E::reorders;
+
+    explicit NegateExpr(const E& expr) : e(expr) {}
+    std::size_t order() const { return e.order(); }
+    bool uses(const SquareMat* m) const { return e.uses(m); }
+    double evalAt(std::size_t i) const { return -e.evalAt(i); }
+    const double* evalBlock(std::size_t off, std::size_t len, double* out) const {
+        detail::kernels().neg(e.evalBlock(off, len, out), out, len);
+        return out;
+    }
+};
+
+// transpose of e. A product with a transposed SquareMat operand runs the fused
+// GEMM kernels on the original buffer, so ~A * B never materializes A^T.
+template <class E>
+class TransposeExpr : public MatExpr<TransposeExpr<E>> {
+    typename detail::ExprStore<E>::type e;
+public:
+    static constexpr bool reorders = true;
+
+    explicit TransposeExpr(const E& expr) : e(expr) {}
+    const E& operand() const { return e; }
+    std::size_t order() const { return e.order(); }
+    bool uses(const SquareMat* m) const { return e.uses(m); }
+    double evalAt(std::size_t i) const {
+        std::size_t n = order();
+        return e.evalAt((i % n) * n + i / n);
+    }
+    const double* evalBlock(std::size_t off, std::size_t len, double* out) const {
+        std::size_t n = order();
+        std::size_t r = off / n, c = off % n;   // position in the result
+        for (std::size_t t = 0; t < len; ++t) {
+            out[t] = e.evalAt(c * n + r);
+            if (++c == n) { c = 0; ++r; }
+        }
+        return out;
+    }
+};
+
+// ===== Lazy Element-wise Operators =====
+
+// matrix + matrix
+template <class L, class R>
+BinaryExpr<detail::AddOp, L, R> operator+(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return BinaryExpr<detail::AddOp, L, R>(l.self(), r.self());
+}
+
+// matrix - matrix
+template <class L, class R>
+BinaryExpr<detail::SubOp, L, R> operator-(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return BinaryExpr<detail::SubOp, L, R>(l.self(), r.self());
+}
+
+// element-wise matrix % matrix
+template <class L, class R>
+BinaryExpr<detail::MulOp, L, R> operator%(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return BinaryExpr<detail::MulOp, L, R>(l.self(), r.self());
+}
+
+// scalar * matrix
+template <class E>
+ScalarExpr<detail::ScaleOp, E> operator*(double s, const MatExpr<E>& e) {
+    return ScalarExpr<detail::ScaleOp, E>(e.self(), s);
+}
+
+// matrix * scalar
+template <class E>
+ScalarExpr<detail::ScaleOp, E> operator*(const MatExpr<E>& e, double s) {
+    return ScalarExpr<detail::ScaleOp, E>(e.self(), s);
+}
+
+// matrix / scalar
+template <class E>
+ScalarExpr<detail::DivOp, E> operator/(const MatExpr<E>& e, double s);
+
+// negate elements
+template <class E>
+NegateExpr<E> operator-(const MatExpr<E>& e) {
+    return NegateExpr<E>(e.self());
+}
+
+// transpose of an expression (SquareMat has its own member operator~)
+template <class E>
+TransposeExpr<E> operator~(const MatExpr<E>& e) {
+    return TransposeExpr<E>(e.self());
+}
+
+} // namespace MatrixLib
+#endif
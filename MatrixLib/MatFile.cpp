@@ -0,0 +1,353 @@
+// eitan.derdiger@gmail.com
+
+#include "MatFile.h"
+#include "SquareMat.h"
+#include "ThreadPool.h"
+#include <cstdio>      // for fopen, fread, fwrite, rename
+#include <cstring>     // for memcpy, memcmp
+#include <cstdint>     // for SIZE_MAX
+#include <stdexcept>   // for runtime_error, invalid_argument
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MATRIXLIB_MMAP 1
+#include <fcntl.h>     // for open
+#include <sys/mman.h>  // for mmap, msync, munmap
+#include <sys/stat.h>  // for fstat
+#include <unistd.h>    // for close, write, ftruncate
+#endif
+
+using namespace MatrixLib;
+
+namespace MatrixLib {
+namespace detail {
+
+// a mapping of a whole matrix file (header included)
+struct FileMap {
+    void* base;
+    std::size_t bytes;
+    bool shared;
+};
+
+} // namespace detail
+} // namespace MatrixLib
+
+namespace {
+
+const char MAGIC[8] = {'S', 'Q', 'M', 'A', 'T', 'R', 'I', 'X'};
+
+// ======= Byte Order =======
+
+bool hostLittle() {
+    const std::uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+std::uint8_t hostOrder() { return hostLittle() ? MATFILE_LITTLE : MATFILE_BIG; }
+
+std::uint64_t swap64(std::uint64_t x) {
+    x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+    x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+    return (x << 32) | (x >> 32);
+}
+std::uint32_t swap32(std::uint32_t x) {
+    x = ((x & 0x00FF00FFu) << 8) | ((x >> 8) & 0x00FF00FFu);
+    return (x << 16) | (x >> 16);
+}
+
+// ======= Checksum =======
+// xxHash64's round and finalizer (constants and rotations), applied per lane
+
+constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t P3 = 0x165667B19E3779F9ull;
+
+inline std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+inline std::uint64_t mixRound(std::uint64_t acc, std::uint64_t w) { return rotl(acc + w * P2, 31) * P1; }
+inline std::uint64_t avalanche(std::uint64_t h) {
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+inline std::uint64_t bitsOf(double d) {
+    std::uint64_t w;
+    std::memcpy(&w, &d, sizeof w);
+    return w;
+}
+
+// one chunk: four independent lanes over consecutive words, then the tail
+std::uint64_t chunkDigest(const double* p, std::size_t count) {
+    std::uint64_t v[4] = {P1 + P2, P2, 0, 0 - P1};
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        for (int l = 0; l < 4; ++l)
+            v[l] = mixRound(v[l], bitsOf(p[i + l]));
+    std::uint64_t h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18) + count;
+    for (; i < count; ++i)
+        h = rotl(h ^ mixRound(0, bitsOf(p[i])), 27) * P1 + P3;
+    return avalanche(h);
+}
+
+// ======= Header =======
+
+struct Header {
+    std::uint32_t version;
+    std::uint8_t dtype;
+    std::uint8_t endian;
+    std::uint8_t flags;
+    std::uint64_t order;
+    std::uint64_t checksum;
+};
+
+// header in the host's byte order
+void encodeHeader(unsigned char* raw, std::uint64_t order, std::uint64_t sum, std::uint8_t flags) {
+    std::memset(raw, 0, MATFILE_HEADER);
+    std::memcpy(raw, MAGIC, sizeof MAGIC);
+    std::memcpy(raw + 8, &MATFILE_VERSION, 4);
+    raw[12] = MATFILE_F64;
+    raw[13] = hostOrder();
+    raw[14] = flags;
+    std::memcpy(raw + 16, &order, 8);
+    std::memcpy(raw + 24, &sum, 8);
+}
+
+// parse and validate everything that does not need the payload
+Header decodeHeader(const unsigned char* raw) {
+    if (std::memcmp(raw, MAGIC, sizeof MAGIC) != 0)
+        throw std::invalid_argument("not a matrix file");
+    Header h;
+    h.endian = raw[13];
+    if (h.endian != MATFILE_LITTLE && h.endian != MATFILE_BIG)
+        throw std::invalid_argument("bad byte order");
+    bool foreign = h.endian != hostOrder();
+    std::memcpy(&h.version, raw + 8, 4);
+    std::memcpy(&h.order, raw + 16, 8);
+    std::memcpy(&h.checksum, raw + 24, 8);
+    if (foreign) {
+        h.version = swap32(h.version);
+        h.order = swap64(h.order);
+        h.checksum = swap64(h.checksum);
+    }
+    h.dtype = raw[12];
+    h.flags = raw[14];
+    if (h.version == 0 || h.version > MATFILE_VERSION)
+        throw std::invalid_argument("unsupported matrix file version");
+    if (h.dtype != MATFILE_F64)
+        throw std::invalid_argument("unsupported element type");
+    if (h.order && h.order > (SIZE_MAX - MATFILE_HEADER) / sizeof(double) / h.order)
+        throw std::invalid_argument("matrix file size");
+    return h;
+}
+
+void verifySum(const Header& h, const double* p, std::size_t count) {
+    if (h.flags & MATFILE_STALE)
+        throw std::invalid_argument("checksum not sealed (file is or was mapped Shared)");
+    if (detail::checksum(p, count) != h.checksum)
+        throw std::invalid_argument("checksum mismatch");
+}
+
+#ifdef MATRIXLIB_MMAP
+// write the current checksum into a Shared mapping's header and clear STALE
+void reseal(const detail::FileMap& m) {
+    unsigned char* raw = static_cast<unsigned char*>(m.base);
+    std::uint64_t order;
+    std::memcpy(&order, raw + 16, 8);
+    const double* p = reinterpret_cast<const double*>(raw + MATFILE_HEADER);
+    std::uint64_t sum = detail::checksum(p, static_cast<std::size_t>(order * order));
+    std::memcpy(raw + 24, &sum, 8);
+    raw[14] &= static_cast<unsigned char>(~MATFILE_STALE);
+}
+#endif
+
+} // namespace
+
+namespace MatrixLib {
+namespace detail {
+
+// ======= Checksum / Mapping Helpers =======
+
+std::uint64_t checksum(const double* p, std::size_t count) {
+    std::size_t chunks = (count + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+    std::uint64_t h = P3;
+    if (chunks <= 1) {
+        if (chunks) h = mixRound(h, chunkDigest(p, count));
+        return avalanche(h ^ count);
+    }
+    std::uint64_t* digest = new std::uint64_t[chunks];
+    try {
+        ThreadPool::instance().parallelFor(chunks, 1, [&](std::size_t c0, std::size_t c1) {
+            for (std::size_t c = c0; c < c1; ++c) {
+                std::size_t off = c * CHECKSUM_CHUNK;
+                std::size_t len = count - off < CHECKSUM_CHUNK ? count - off : CHECKSUM_CHUNK;
+                digest[c] = chunkDigest(p + off, len);
+            }
+        });
+    } catch (...) {
+        delete[] digest;
+        throw;
+    }
+    for (std::size_t c = 0; c < chunks; ++c)
+        h = mixRound(h, digest[c]);
+    delete[] digest;
+    return avalanche(h ^ count);
+}
+
+void unmapFile(FileMap* map) noexcept {
+#ifdef MATRIXLIB_MMAP
+    if (map->shared) {
+        try {
+            reseal(*map);
+        } catch (...) {
+            // leave STALE set: load() will refuse the file rather than trust it
+        }
+    }
+    munmap(map->base, map->bytes);
+#endif
+    delete map;
+}
+
+} // namespace detail
+
+// ======= Binary Files =======
+
+// Written to path.tmp and renamed over path, so a reader (or a mapping of the
+// old file) never sees a half-written matrix
+void SquareMat::save(const std::string& path) const {
+    unsigned char raw[MATFILE_HEADER];
+    encodeHeader(raw, n, detail::checksum(elems, n * n), 0);
+
+    std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot open " + tmp);
+    bool ok = std::fwrite(raw, 1, MATFILE_HEADER, f) == MATFILE_HEADER &&
+              (n == 0 || std::fwrite(elems, sizeof(double), n * n, f) == n * n);   // empty: no buffer
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+SquareMat SquareMat::load(const std::string& path) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("cannot open " + path);
+    try {
+        unsigned char raw[MATFILE_HEADER];
+        if (std::fread(raw, 1, MATFILE_HEADER, f) != MATFILE_HEADER)
+            throw std::invalid_argument("truncated matrix file");
+        Header h = decodeHeader(raw);
+        std::size_t count = static_cast<std::size_t>(h.order * h.order);
+        // size check before allocating, so a corrupt order cannot ask for terabytes
+        if (std::fseek(f, 0, SEEK_END) != 0 ||
+            static_cast<std::size_t>(std::ftell(f)) != MATFILE_HEADER + count * sizeof(double) ||
+            std::fseek(f, static_cast<long>(MATFILE_HEADER), SEEK_SET) != 0)
+            throw std::invalid_argument("matrix file size");
+
+        SquareMat M(static_cast<std::size_t>(h.order), Uninit{});
+        if (count && std::fread(M.elems, sizeof(double), count, f) != count)
+            throw std::invalid_argument("truncated matrix file");
+        if (h.endian != hostOrder()) {
+            for (std::size_t i = 0; i < count; ++i) {
+                std::uint64_t w = swap64(bitsOf(M.elems[i]));
+                std::memcpy(M.elems + i, &w, sizeof w);
+            }
+        }
+        verifySum(h, M.elems, count);
+        std::fclose(f);
+        return M;
+    } catch (...) {
+        std::fclose(f);
+        throw;
+    }
+}
+
+#ifdef MATRIXLIB_MMAP
+
+SquareMat SquareMat::mapFile(const std::string& path, MapMode mode, bool verify) {
+    bool shared = mode == MapMode::Shared;
+    int fd = ::open(path.c_str(), shared ? O_RDWR : O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot stat " + path);
+    }
+    std::size_t bytes = static_cast<std::size_t>(st.st_size);
+    if (bytes < MATFILE_HEADER) {
+        ::close(fd);
+        throw std::invalid_argument("truncated matrix file");
+    }
+    // private maps are writable too: pages are copied on the first write
+    void* base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                        shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    ::close(fd);   // the mapping keeps the file open
+    if (base == MAP_FAILED) throw std::runtime_error("cannot map " + path);
+
+    unsigned char* raw = static_cast<unsigned char*>(base);
+    double* payload = reinterpret_cast<double*>(raw + MATFILE_HEADER);
+    detail::FileMap* map = nullptr;
+    try {
+        Header h = decodeHeader(raw);
+        if (h.endian != hostOrder())
+            throw std::invalid_argument("byte order differs from the host (use load)");
+        std::size_t count = static_cast<std::size_t>(h.order * h.order);
+        if (bytes != MATFILE_HEADER + count * sizeof(double))
+            throw std::invalid_argument("matrix file size");
+        if (verify) verifySum(h, payload, count);
+        if (h.order == 0) {
+            ::munmap(base, bytes);
+            return SquareMat();
+        }
+        map = new detail::FileMap{base, bytes, shared};
+        if (shared) raw[14] |= MATFILE_STALE;   // until reseal
+
+        SquareMat M;
+        M.n = static_cast<std::size_t>(h.order);
+        M.elems = payload;
+        M.map = map;
+        return M;
+    } catch (...) {
+        delete map;
+        ::munmap(base, bytes);
+        throw;
+    }
+}
+
+void SquareMat::sync() {
+    if (!map || !map->shared) return;
+    reseal(*map);
+    if (::msync(map->base, map->bytes, MS_SYNC) != 0)
+        throw std::runtime_error("msync failed");
+}
+
+void detail::createMatFile(const std::string& path, std::size_t order) {
+    if (order && order > (SIZE_MAX - MATFILE_HEADER) / sizeof(double) / order)
+        throw std::invalid_argument("matrix file size");
+    unsigned char raw[MATFILE_HEADER];
+    encodeHeader(raw, order, 0, MATFILE_STALE);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("cannot open " + path);
+    bool ok = ::write(fd, raw, MATFILE_HEADER) == static_cast<ssize_t>(MATFILE_HEADER) &&
+              ::ftruncate(fd, static_cast<off_t>(MATFILE_HEADER + order * order * sizeof(double))) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok) throw std::runtime_error("cannot write " + path);
+}
+
+#else
+
+SquareMat SquareMat::mapFile(const std::string&, MapMode, bool) {
+    throw std::logic_error("mapFile needs mmap (POSIX)");
+}
+
+void SquareMat::sync() {}
+
+void detail::createMatFile(const std::string&, std::size_t) {
+    throw std::logic_error("createMatFile needs POSIX");
+}
+
+#endif
+
+} // namespace MatrixLib
@@ -0,0 +1,68 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_MATFILE_H
+#define MATRIXLIB_MATFILE_H
+
+#include <cstddef>      // for size_t
+#include <cstdint>      // for fixed-width header fields
+#include <string>       // for paths
+
+namespace MatrixLib {
+
+// ===== Binary Matrix Files =====
+//
+// SquareMat::save / load / mapFile use one versioned format: a 64-byte header
+// followed by the n * n elements in row-major order as raw IEEE-754 doubles.
+// The header is as long as a cache line, so a mapped payload keeps the
+// MATRIX_ALIGN alignment of ordinary buffers.
+//
+//   offset  size  field
+//        0     8  magic "SQMATRIX"
+//        8     4  format version (MATFILE_VERSION)
+//       12     1  element type (MATFILE_F64)
+//       13     1  byte order of every field and element (MATFILE_LITTLE / _BIG)
+//       14     1  flags (MATFILE_STALE: mapped Shared and not sealed since)
+//       15     1  reserved, 0
+//       16     8  order n
+//       24     8  checksum of the elements (detail::checksum)
+//       32    32  reserved, 0
+//
+// load() reads either byte order; mapFile() needs the host's, since a foreign
+// file cannot be used in place.
+
+constexpr std::size_t MATFILE_HEADER = 64;
+constexpr std::uint32_t MATFILE_VERSION = 1;
+constexpr std::uint8_t MATFILE_F64 = 1;
+constexpr std::uint8_t MATFILE_LITTLE = 1;
+constexpr std::uint8_t MATFILE_BIG = 2;
+constexpr std::uint8_t MATFILE_STALE = 1;
+
+// how SquareMat::mapFile shares the file
+enum class MapMode {
+    Private,   // copy-on-write: the matrix can be modified, the file never is
+    Shared     // writes go to the file; sync() and destruction reseal the checksum
+};
+
+namespace detail {
+
+// Checksum of count doubles, taken over their bit patterns (so it does not
+// depend on the byte order they were stored in). Chunks of CHECKSUM_CHUNK
+// are hashed in parallel, four 64-bit lanes each, and the chunk digests are
+// folded in order: the same value for any thread count.
+constexpr std::size_t CHECKSUM_CHUNK = std::size_t(1) << 16;
+std::uint64_t checksum(const double* p, std::size_t count);
+
+// a live mapping owned by a SquareMat (defined in MatFile.cpp)
+struct FileMap;
+
+// reseal a Shared mapping's header, then unmap it (errors are swallowed)
+void unmapFile(FileMap* map) noexcept;
+
+// Create (or truncate) path as an order x order file of zeros, sparse where
+// the file system allows, marked STALE: for writers that fill it through a
+// Shared mapping, which reseals it. POSIX only (logic_error elsewhere).
+void createMatFile(const std::string& path, std::size_t order);
+
+} // namespace detail
+} // namespace MatrixLib
+#endif
@@ -0,0 +1,952 @@
+// eitan.derdiger@gmail.com
+
+#include "OutOfCore.h"
+#include "Alloc.h"
+#include "Gemm.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include <algorithm>            // for std::min, std::fill, std::copy
+#include <cmath>                // for fabs, log
+#include <cstdint>              // for SIZE_MAX
+#include <cstdlib>              // for getenv
+#include <cstring>              // for memcpy
+#include <limits>               // for infinity
+#include <mutex>                // for the cache lock
+#include <condition_variable>   // for waiting on tiles in flight
+#include <thread>               // for the prefetch thread
+#include <stdexcept>            // for exceptions
+
+#include <cerrno>               // for EINTR
+#include <stdlib.h>             // for mkstemp
+#include <unistd.h>             // for pread, pwrite, ftruncate, unlink, close
+
+using namespace MatrixLib;
+
+namespace {
+
+constexpr std::size_t NONE = SIZE_MAX;
+
+using detail::PAR_GRAIN;
+
+} // namespace
+
+namespace MatrixLib {
+namespace detail {
+
+// ======= Tile Store =======
+//
+// One tile file and its cache. Slots hold one tile each; the unpinned ones
+// form an LRU list (head = next victim). A slot being filled or written back
+// is `busy`, and so is the tile leaving it until its write-back lands, so no
+// reader can see a stale copy. All bookkeeping is under one mutex; disk I/O
+// runs outside it.
+class TileStore {
+public:
+    enum class Access { Read, Update, Overwrite };
+
+    TileStore(std::size_t tileOrder, std::size_t count, std::size_t budget, const std::string& dir);
+    ~TileStore();
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    // tile in memory until unpin; Overwrite skips the read (contents undefined)
+    double* pin(std::size_t tile, Access access);
+    void unpin(std::size_t tile, bool dirty);
+
+    // queue a tile for the background reader (dropped when the queue is full)
+    void prefetch(std::size_t tile);
+
+    void flush();
+    TileStats stats();
+
+    // Scratch tiles after the matrix's own, sharing its cache: extend() adds
+    // `extra` zero tiles and returns the first id, discard() drops every tile
+    // from `first` on, cached copies included (waiting for their pins to go).
+    // Callers hold scratchLock() from extend() to discard(), so concurrent
+    // const operations never share or drop each other's scratch.
+    std::size_t extend(std::size_t extra);
+    void discard(std::size_t first) noexcept;
+    std::mutex& scratchLock() { return scratch; }
+
+private:
+    struct Slot {
+        double* data;
+        std::size_t tile;   // NONE when empty
+        std::size_t pins;
+        bool dirty;
+        bool busy;
+        std::size_t prev, next;   // LRU links (NONE at the ends)
+    };
+
+    std::size_t elems;          // doubles per tile
+    std::size_t count;          // tiles in the file
+    std::size_t nslots;
+    int fd;
+    Slot* slots;
+    std::size_t* slotOf;        // tile -> slot, NONE when not cached
+    bool* leaving;              // tile is being written back
+    std::size_t head = NONE, tail = NONE;
+
+    std::mutex m;
+    std::mutex scratch;                 // one extend() .. discard() at a time
+    std::condition_variable changed;    // a slot finished I/O or was unpinned
+
+    std::thread io;                     // prefetch thread (started on first prefetch)
+    std::condition_variable queued;
+    std::size_t* queue;                 // ring of nslots tile indices
+    std::size_t qHead = 0, qLen = 0;
+    bool stopping = false;
+
+    TileStats counters{};
+
+    void unlink(std::size_t s);
+    void pushBack(std::size_t s);       // most recently used
+    void pushFront(std::size_t s);      // next victim
+    std::size_t claim(std::size_t tile, std::unique_lock<std::mutex>& lk, bool wait);
+    void fill(std::size_t s, std::size_t old, bool writeBack, std::size_t tile, bool read);
+    void readTile(std::size_t tile, double* p);
+    void writeTile(std::size_t tile, const double* p);
+    void prefetchLoop();
+};
+
+TileStore::TileStore(std::size_t tileOrder, std::size_t tiles, std::size_t budget, const std::string& dir)
+    : elems(tileOrder * tileOrder), count(tiles), nslots(budget / (tileOrder * tileOrder * sizeof(double))),
+      fd(-1), slots(nullptr), slotOf(nullptr), leaving(nullptr), queue(nullptr) {
+    if (nslots < 4) throw std::invalid_argument("tile budget below 4 tiles");
+    if (nslots > count + 4) nslots = count + 4;   // never more slots than tiles (+ spare)
+
+    std::string base = dir;
+    if (base.empty()) {
+        const char* env = std::getenv("TMPDIR");
+        base = env && *env ? env : "/tmp";
+    }
+    std::string path = base + "/matrixlib-tiles-XXXXXX";
+    fd = ::mkstemp(&path[0]);
+    if (fd < 0) throw std::runtime_error("cannot create tile file in " + base);
+    ::unlink(path.c_str());   // removed with the last descriptor
+    // sparse: tiles never written read back as zeros
+    if (::ftruncate(fd, static_cast<off_t>(count * elems * sizeof(double))) != 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot size tile file");
+    }
+
+    try {
+        slots = new Slot[nslots];
+        for (std::size_t s = 0; s < nslots; ++s)
+            slots[s] = Slot{nullptr, NONE, 0, false, false, NONE, NONE};
+        for (std::size_t s = 0; s < nslots; ++s) {
+            slots[s].data = allocDoubles(elems);
+            pushBack(s);
+        }
+        slotOf = new std::size_t[count ? count : 1];
+        std::fill(slotOf, slotOf + count, NONE);
+        leaving = new bool[count ? count : 1]();
+        queue = new std::size_t[nslots];
+    } catch (...) {
+        if (slots)
+            for (std::size_t s = 0; s < nslots; ++s) freeDoubles(slots[s].data, elems);
+        delete[] slots;
+        delete[] slotOf;
+        delete[] leaving;
+        ::close(fd);
+        throw;
+    }
+    counters.capacity = nslots;
+}
+
+TileStore::~TileStore() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stopping = true;
+    }
+    queued.notify_all();
+    if (io.joinable()) io.join();
+    for (std::size_t s = 0; s < nslots; ++s) freeDoubles(slots[s].data, elems);
+    delete[] slots;
+    delete[] slotOf;
+    delete[] leaving;
+    delete[] queue;
+    ::close(fd);   // the file goes with it
+}
+
+// ======= LRU List =======
+
+void TileStore::unlink(std::size_t s) {
+    Slot& x = slots[s];
+    if (x.prev != NONE) slots[x.prev].next = x.next; else head = x.next;
+    if (x.next != NONE) slots[x.next].prev = x.prev; else tail = x.prev;
+    x.prev = x.next = NONE;
+}
+
+void TileStore::pushBack(std::size_t s) {
+    slots[s].prev = tail;
+    slots[s].next = NONE;
+    if (tail != NONE) slots[tail].next = s; else head = s;
+    tail = s;
+}
+
+void TileStore::pushFront(std::size_t s) {
+    slots[s].prev = NONE;
+    slots[s].next = head;
+    if (head != NONE) slots[head].prev = s; else tail = s;
+    head = s;
+}
+
+// ======= Disk I/O =======
+
+void TileStore::readTile(std::size_t tile, double* p) {
+    char* dst = reinterpret_cast<char*>(p);
+    std::size_t left = elems * sizeof(double);
+    off_t off = static_cast<off_t>(tile * elems * sizeof(double));
+    while (left) {
+        ssize_t got = ::pread(fd, dst, left, off);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) throw std::runtime_error("tile read failed");
+        dst += got;
+        off += got;
+        left -= static_cast<std::size_t>(got);
+    }
+}
+
+void TileStore::writeTile(std::size_t tile, const double* p) {
+    const char* src = reinterpret_cast<const char*>(p);
+    std::size_t left = elems * sizeof(double);
+    off_t off = static_cast<off_t>(tile * elems * sizeof(double));
+    while (left) {
+        ssize_t put = ::pwrite(fd, src, left, off);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) throw std::runtime_error("tile write failed");
+        src += put;
+        off += put;
+        left -= static_cast<std::size_t>(put);
+    }
+}
+
+// ======= Cache =======
+
+// Take the LRU slot for `tile` (returns NONE if none is free and !wait).
+// The slot comes back busy; the caller fills it with fill() outside the lock.
+std::size_t TileStore::claim(std::size_t tile, std::unique_lock<std::mutex>& lk, bool wait) {
+    std::size_t s;
+    for (;;) {
+        // the LRU list can hold slots flush() is writing; pass over them
+        s = head;
+        while (s != NONE && slots[s].busy) s = slots[s].next;
+        if (s != NONE) break;
+        if (!wait) return NONE;
+        bool inFlight = false;
+        for (std::size_t k = 0; k < nslots && !inFlight; ++k) inFlight = slots[k].busy;
+        if (!inFlight) throw std::logic_error("every cached tile is pinned");
+        changed.wait(lk);
+    }
+    unlink(s);
+    Slot& x = slots[s];
+    if (x.tile != NONE) {
+        slotOf[x.tile] = NONE;
+        if (x.dirty) leaving[x.tile] = true;
+    }
+    slotOf[tile] = s;
+    x.busy = true;
+    return s;
+}
+
+// write back the slot's old tile if dirty, then read `tile` into it
+void TileStore::fill(std::size_t s, std::size_t old, bool writeBack, std::size_t tile, bool read) {
+    Slot& x = slots[s];
+    if (writeBack) writeTile(old, x.data);
+    if (read) readTile(tile, x.data);
+}
+
+double* TileStore::pin(std::size_t tile, Access access) {
+    std::unique_lock<std::mutex> lk(m);
+    for (;;) {
+        std::size_t s = slotOf[tile];
+        if (s != NONE) {
+            Slot& x = slots[s];
+            if (x.busy) { changed.wait(lk); continue; }
+            if (x.pins++ == 0) unlink(s);
+            ++counters.hits;
+            return x.data;
+        }
+        if (leaving[tile]) { changed.wait(lk); continue; }
+
+        s = claim(tile, lk, true);
+        Slot& x = slots[s];
+        std::size_t old = x.tile;
+        bool writeBack = old != NONE && x.dirty;
+        bool read = access != Access::Overwrite;
+        x.tile = tile;
+        x.dirty = false;
+        x.pins = 1;
+        ++counters.misses;
+        lk.unlock();
+        try {
+            fill(s, old, writeBack, tile, read);
+        } catch (...) {
+            lk.lock();
+            if (writeBack) leaving[old] = false;
+            slotOf[tile] = NONE;
+            x.tile = NONE;
+            x.pins = 0;
+            x.busy = false;
+            pushFront(s);
+            changed.notify_all();
+            throw;
+        }
+        lk.lock();
+        if (writeBack) {
+            leaving[old] = false;
+            ++counters.writes;
+        }
+        if (read) ++counters.reads;
+        x.busy = false;
+        changed.notify_all();
+        return x.data;
+    }
+}
+
+void TileStore::unpin(std::size_t tile, bool dirty) {
+    std::lock_guard<std::mutex> lk(m);
+    Slot& x = slots[slotOf[tile]];
+    x.dirty = x.dirty || dirty;
+    if (--x.pins == 0) {
+        pushBack(slotOf[tile]);
+        changed.notify_all();
+    }
+}
+
+void TileStore::prefetch(std::size_t tile) {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        if (tile >= count || slotOf[tile] != NONE || qLen == nslots) return;
+        queue[(qHead + qLen++) % nslots] = tile;
+        if (!io.joinable()) io = std::thread(&TileStore::prefetchLoop, this);
+    }
+    queued.notify_one();
+}
+
+// Background reader: loads queued tiles into free slots and files them as
+// most recently used. Never waits for a slot; errors leave the tile to pin().
+void TileStore::prefetchLoop() {
+    std::unique_lock<std::mutex> lk(m);
+    for (;;) {
+        queued.wait(lk, [&] { return stopping || qLen; });
+        if (stopping) return;
+        std::size_t tile = queue[qHead];
+        qHead = (qHead + 1) % nslots;
+        --qLen;
+        if (tile >= count || slotOf[tile] != NONE || leaving[tile]) continue;   // discarded, or there
+        std::size_t s = claim(tile, lk, false);
+        if (s == NONE) continue;
+
+        Slot& x = slots[s];
+        std::size_t old = x.tile;
+        bool writeBack = old != NONE && x.dirty;
+        x.tile = tile;
+        x.dirty = false;
+        x.pins = 0;
+        lk.unlock();
+        bool ok = true;
+        try {
+            fill(s, old, writeBack, tile, true);
+        } catch (...) {
+            ok = false;
+        }
+        lk.lock();
+        if (writeBack) {
+            leaving[old] = false;
+            if (ok) ++counters.writes;
+        }
+        x.busy = false;
+        if (ok) {
+            ++counters.reads;
+            ++counters.prefetched;
+            pushBack(s);
+        } else {
+            // the old tile's write-back may have failed too: keep it dirty in place
+            slotOf[tile] = NONE;
+            x.tile = writeBack ? old : NONE;
+            x.dirty = writeBack;
+            if (writeBack) slotOf[old] = s;
+            pushFront(s);
+        }
+        changed.notify_all();
+    }
+}
+
+// Each dirty tile is written like an eviction: the slot is busy (pins wait,
+// claim() passes over it) while the lock is dropped, and keeps its LRU place
+void TileStore::flush() {
+    std::unique_lock<std::mutex> lk(m);
+    for (std::size_t s = 0; s < nslots; ++s) {
+        Slot& x = slots[s];
+        while (x.busy) changed.wait(lk);
+        if (x.tile == NONE || !x.dirty || x.pins) continue;
+        x.busy = true;
+        x.dirty = false;
+        lk.unlock();
+        try {
+            writeTile(x.tile, x.data);
+        } catch (...) {
+            lk.lock();
+            x.busy = false;
+            x.dirty = true;
+            changed.notify_all();
+            throw;
+        }
+        lk.lock();
+        x.busy = false;
+        ++counters.writes;
+        changed.notify_all();
+    }
+}
+
+std::size_t TileStore::extend(std::size_t extra) {
+    std::lock_guard<std::mutex> lk(m);
+    std::size_t grown = count + extra;
+    std::size_t* newSlotOf = new std::size_t[grown];
+    bool* newLeaving;
+    try {
+        newLeaving = new bool[grown]();
+    } catch (...) {
+        delete[] newSlotOf;
+        throw;
+    }
+    if (::ftruncate(fd, static_cast<off_t>(grown * elems * sizeof(double))) != 0) {
+        delete[] newSlotOf;
+        delete[] newLeaving;
+        throw std::runtime_error("cannot size tile file");
+    }
+    std::copy(slotOf, slotOf + count, newSlotOf);
+    std::fill(newSlotOf + count, newSlotOf + grown, NONE);
+    std::copy(leaving, leaving + count, newLeaving);
+    delete[] slotOf;
+    delete[] leaving;
+    slotOf = newSlotOf;
+    leaving = newLeaving;
+    std::size_t first = count;
+    count = grown;
+    return first;
+}
+
+void TileStore::discard(std::size_t first) noexcept {
+    std::unique_lock<std::mutex> lk(m);
+    // let reads and write-backs land and scratch tiles be unpinned first
+    for (;;) {
+        bool inUse = false;
+        for (std::size_t s = 0; s < nslots && !inUse; ++s) {
+            const Slot& x = slots[s];
+            inUse = x.busy || (x.tile != NONE && x.tile >= first && x.pins);
+        }
+        if (!inUse) break;
+        changed.wait(lk);
+    }
+    for (std::size_t s = 0; s < nslots; ++s) {
+        Slot& x = slots[s];
+        if (x.tile == NONE || x.tile < first) continue;
+        slotOf[x.tile] = NONE;
+        x.tile = NONE;
+        x.dirty = false;
+        unlink(s);
+        pushFront(s);   // free slots are the first victims
+    }
+    count = first;
+    if (::ftruncate(fd, static_cast<off_t>(count * elems * sizeof(double))) != 0) {
+        // the disk space stays in use until the file goes; nothing reads it
+    }
+}
+
+TileStats TileStore::stats() {
+    std::lock_guard<std::mutex> lk(m);
+    TileStats r = counters;
+    r.resident = 0;
+    for (std::size_t s = 0; s < nslots; ++s)
+        if (slots[s].tile != NONE) ++r.resident;
+    return r;
+}
+
+} // namespace detail
+} // namespace MatrixLib
+
+namespace {
+
+using detail::TileStore;
+using Access = TileStore::Access;
+
+// a pinned tile, unpinned (and marked dirty unless read-only) on scope exit
+class Pin {
+    TileStore* s;
+    std::size_t tile;
+    bool dirty;
+    double* p;
+
+public:
+    Pin(TileStore* store, std::size_t t, Access a)
+        : s(store), tile(t), dirty(a != Access::Read), p(store->pin(t, a)) {}
+    ~Pin() { s->unpin(tile, dirty); }
+    Pin(const Pin&) = delete;
+    Pin& operator=(const Pin&) = delete;
+
+    double* data() const { return p; }
+};
+
+void ensureSame(const TiledMat& A, const TiledMat& B) {
+    if (A.order() != B.order() || A.tileOrder() != B.tileOrder())
+        throw std::invalid_argument("order mismatch");
+}
+
+// ======= Left-Looking LU =======
+
+struct Factorization {
+    bool singular;
+    int sign;
+    double det;
+    double logAbs;
+};
+
+// the factors' tiles, appended to the matrix's own tile file (and cache) for
+// one factorization and dropped on every exit path; factorizations of one
+// matrix (say !A on two threads) take turns
+struct ScratchTiles {
+    std::lock_guard<std::mutex> turn;   // released after discard()
+    TileStore* s;
+    std::size_t first;
+
+    ScratchTiles(TileStore* store, std::size_t extra)
+        : turn(store->scratchLock()), s(store), first(store->extend(extra)) {}
+    ~ScratchTiles() { s->discard(first); }
+    ScratchTiles(const ScratchTiles&) = delete;
+    ScratchTiles& operator=(const ScratchTiles&) = delete;
+};
+
+// tile column J of the factors, pinned for one step (row r at row(r))
+struct Panel {
+    TileStore* s;
+    std::size_t first, stride, t;
+    std::size_t pinned = 0;
+    double** tiles;
+
+    Panel(TileStore* store, std::size_t firstTile, std::size_t step, std::size_t count, std::size_t tileOrder)
+        : s(store), first(firstTile), stride(step), t(tileOrder), tiles(new double*[count]) {
+        try {
+            for (; pinned < count; ++pinned)
+                tiles[pinned] = s->pin(first + pinned * stride, Access::Overwrite);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+    ~Panel() { release(); }
+    Panel(const Panel&) = delete;
+    Panel& operator=(const Panel&) = delete;
+
+    double* row(std::size_t r) const { return tiles[r / t] + (r % t) * t; }
+
+    void release() {
+        for (std::size_t i = 0; i < pinned; ++i) s->unpin(first + i * stride, true);
+        delete[] tiles;
+        tiles = nullptr;
+        pinned = 0;
+    }
+};
+
+// scratch of one factorization besides its tiles, freed on every exit path
+struct LUScratch {
+    std::size_t tileLen;
+    double* u = nullptr;           // U block gathered from the panel
+    double* l = nullptr;           // L tile with finished rows masked out
+    std::size_t* perm = nullptr;   // position -> physical row
+    std::size_t* stage = nullptr;  // physical row -> panel that pivoted it (NONE: not yet)
+
+    LUScratch(std::size_t n, std::size_t t, std::size_t nt) : tileLen(t * t) {
+        try {
+            u = detail::allocDoubles(tileLen);
+            l = detail::allocDoubles(tileLen);
+            perm = new std::size_t[n];
+            stage = new std::size_t[nt * t];
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+    ~LUScratch() { release(); }
+    void release() {
+        detail::freeDoubles(u, tileLen);
+        detail::freeDoubles(l, tileLen);
+        delete[] perm;
+        delete[] stage;
+        u = l = nullptr;
+        perm = stage = nullptr;
+    }
+};
+
+// Partial-pivoting LU without physical row swaps: row r of A stays row r of
+// every tile column, perm records which row each pivot came from, and stage
+// which rows are finished. For each tile column J (left to right) the panel is
+// loaded into pinned factor tiles, brought up to date with every earlier
+// factor column K (triangular solve on K's pivot rows, GEMM update of the rows
+// not yet pivoted) and factored with partial pivoting over the remaining rows.
+// The pivots and their order are those of a row-swapping LU. Factor tiles and
+// diagonal blocks share the matrix's cache, so the budget holds for the whole
+// factorization; it must fit one tile column and two more tiles.
+Factorization factorTiles(TileStore* A, std::size_t n, std::size_t t, std::size_t nt) {
+    if (A->stats().capacity < nt + 2)
+        throw std::logic_error("tile budget below one tile column + 2 tiles (determinant)");
+    // factor tile (i, J) at F + i * nt + J, then the diagonal block of each panel
+    ScratchTiles scratch(A, nt * nt + nt);
+    const std::size_t F = scratch.first, Dg = F + nt * nt;
+    LUScratch w(n, t, nt);
+    std::size_t tt = t * t;
+    for (std::size_t r = 0; r < nt * t; ++r) w.stage[r] = r < n ? NONE : 0;   // padding counts as done
+
+    Factorization f{false, 1, 1.0, 0.0};
+    for (std::size_t J = 0; J < nt; ++J) {
+        std::size_t width = std::min(t, n - J * t);
+        Panel P(A, F + J, nt, nt, t);
+        for (std::size_t i = 0; i < nt; ++i) {
+            A->prefetch((i + 1) * nt + J);
+            Pin a(A, i * nt + J, Access::Read);
+            std::memcpy(P.tiles[i], a.data(), tt * sizeof(double));
+        }
+
+        for (std::size_t K = 0; K < J; ++K) {
+            // U_KJ: unit lower solve on panel K's pivot rows, in pivot order
+            {
+                Pin d(A, Dg + K, Access::Read);
+                const double* D = d.data();
+                for (std::size_t a = 0; a < t; ++a) {
+                    const double* ra = P.row(w.perm[K * t + a]);
+                    for (std::size_t b = a + 1; b < t; ++b) {
+                        double x = D[b * t + a];
+                        if (x == 0.0) continue;
+                        double* rb = P.row(w.perm[K * t + b]);
+                        for (std::size_t c = 0; c < t; ++c) rb[c] -= x * ra[c];
+                    }
+                }
+            }
+            for (std::size_t a = 0; a < t; ++a)
+                std::memcpy(w.u + a * t, P.row(w.perm[K * t + a]), t * sizeof(double));
+
+            // rows still unpivoted after panel K: P_i -= L_iK * U_KJ
+            A->prefetch(F + K);
+            for (std::size_t i = 0; i < nt; ++i) {
+                bool live = false;
+                for (std::size_t r = i * t; r < i * t + t && !live; ++r) live = w.stage[r] > K;
+                if (!live) continue;
+                A->prefetch(F + (i + 1) * nt + K);
+                {
+                    Pin l(A, F + i * nt + K, Access::Read);
+                    std::memcpy(w.l, l.data(), tt * sizeof(double));
+                }
+                for (std::size_t r = 0; r < t; ++r)
+                    if (w.stage[i * t + r] <= K) std::fill(w.l + r * t, w.l + r * t + t, 0.0);
+                detail::gemm(t, t, t, -1.0, w.l, t, false, w.u, t, false, 1.0, P.tiles[i], t);
+            }
+        }
+
+        // pivot and eliminate the panel's columns over the remaining rows
+        for (std::size_t c = 0; c < width; ++c) {
+            std::size_t best = NONE;
+            double bestAbs = -1.0;
+            for (std::size_t r = 0; r < n; ++r)
+                if (w.stage[r] == NONE && std::fabs(P.row(r)[c]) > bestAbs) {
+                    bestAbs = std::fabs(P.row(r)[c]);
+                    best = r;
+                }
+            double pv = P.row(best)[c];
+            if (std::fabs(pv) < SquareMat::EPS) {
+                f.singular = true;
+                return f;
+            }
+            w.perm[J * t + c] = best;
+            w.stage[best] = J;
+            f.det *= pv;
+            f.logAbs += std::log(std::fabs(pv));
+
+            const double* pr = P.row(best);
+            ThreadPool::instance().parallelFor(n, PAR_GRAIN / t + 1, [&](std::size_t r0, std::size_t r1) {
+                for (std::size_t r = r0; r < r1; ++r) {
+                    if (w.stage[r] != NONE) continue;
+                    double* row = P.row(r);
+                    double x = row[c] / pv;
+                    row[c] = x;
+                    for (std::size_t k = c + 1; k < t; ++k) row[k] -= x * pr[k];
+                }
+            });
+        }
+        if (J + 1 < nt) {   // the last block is never read back
+            Pin d(A, Dg + J, Access::Overwrite);
+            std::fill(d.data(), d.data() + tt, 0.0);
+            for (std::size_t a = 0; a < width; ++a)
+                std::memcpy(d.data() + a * t, P.row(w.perm[J * t + a]), t * sizeof(double));
+        }
+    }
+
+    // parity of the row permutation, by cycles
+    bool* seen = new bool[n]();
+    for (std::size_t g = 0; g < n; ++g) {
+        if (seen[g]) continue;
+        std::size_t len = 0;
+        for (std::size_t x = g; !seen[x]; x = w.perm[x]) {
+            seen[x] = true;
+            ++len;
+        }
+        if (len % 2 == 0) f.sign = -f.sign;
+    }
+    delete[] seen;
+    return f;
+}
+
+} // namespace
+
+namespace MatrixLib {
+
+// ======= Constructors =======
+
+TiledMat::TiledMat(std::size_t order, const TiledConfig& config, double initVal)
+    : n(order), t(config.tile), nt(0), cfg(config), store(nullptr) {
+    if (t == 0) throw std::invalid_argument("tile order");
+    nt = (n + t - 1) / t;
+    store = new detail::TileStore(t, nt * nt, cfg.budget, cfg.dir);
+    if (initVal == 0.0) return;   // the sparse file already reads as zeros
+    try {
+        for (std::size_t i = 0; i < nt; ++i)
+            for (std::size_t j = 0; j < nt; ++j) {
+                Pin p(store, i * nt + j, Access::Overwrite);
+                std::size_t rows = std::min(t, n - i * t), cols = std::min(t, n - j * t);
+                std::fill(p.data(), p.data() + t * t, 0.0);
+                for (std::size_t r = 0; r < rows; ++r)
+                    std::fill(p.data() + r * t, p.data() + r * t + cols, initVal);
+            }
+    } catch (...) {
+        delete store;
+        throw;
+    }
+}
+
+TiledMat::TiledMat(const SquareMat& m, const TiledConfig& config)
+    : TiledMat(m.order(), config) {
+    const double* src = m.data();
+    for (std::size_t i = 0; i < nt; ++i)
+        for (std::size_t j = 0; j < nt; ++j) {
+            Pin p(store, i * nt + j, Access::Overwrite);
+            std::size_t rows = std::min(t, n - i * t), cols = std::min(t, n - j * t);
+            std::fill(p.data(), p.data() + t * t, 0.0);
+            for (std::size_t r = 0; r < rows; ++r)
+                std::copy(src + (i * t + r) * n + j * t, src + (i * t + r) * n + j * t + cols, p.data() + r * t);
+        }
+}
+
+TiledMat::TiledMat(const TiledMat& other)
+    : TiledMat(other.n, other.cfg) {
+    for (std::size_t k = 0; k < nt * nt; ++k) {
+        other.store->prefetch(k + 1);
+        Pin src(other.store, k, Access::Read);
+        Pin dst(store, k, Access::Overwrite);
+        std::memcpy(dst.data(), src.data(), t * t * sizeof(double));
+    }
+}
+
+TiledMat& TiledMat::operator=(const TiledMat& other) {
+    if (this != &other) {
+        TiledMat tmp(other);
+        std::swap(n, tmp.n);
+        std::swap(t, tmp.t);
+        std::swap(nt, tmp.nt);
+        std::swap(cfg, tmp.cfg);
+        std::swap(store, tmp.store);
+    }
+    return *this;
+}
+
+TiledMat::TiledMat(TiledMat&& other) noexcept
+    : n(other.n), t(other.t), nt(other.nt), cfg(std::move(other.cfg)), store(other.store) {
+    other.n = other.nt = 0;
+    other.store = nullptr;
+}
+
+TiledMat& TiledMat::operator=(TiledMat&& other) noexcept {
+    if (this != &other) {
+        delete store;
+        n = other.n;
+        t = other.t;
+        nt = other.nt;
+        cfg = std::move(other.cfg);
+        store = other.store;
+        other.n = other.nt = 0;
+        other.store = nullptr;
+    }
+    return *this;
+}
+
+TiledMat::~TiledMat() {
+    delete store;
+}
+
+// ======= Files =======
+
+TiledMat TiledMat::load(const std::string& path, const TiledConfig& config) {
+    SquareMat src = SquareMat::mapFile(path, MapMode::Private);   // pages come in as tiles are cut
+    return TiledMat(src, config);
+}
+
+void TiledMat::save(const std::string& path) const {
+    if (n == 0) return SquareMat().save(path);
+    detail::createMatFile(path, n);
+    SquareMat dst = SquareMat::mapFile(path, MapMode::Shared);    // resealed when it goes out of scope
+    double* out = dst.data();
+    for (std::size_t i = 0; i < nt; ++i)
+        for (std::size_t j = 0; j < nt; ++j) {
+            store->prefetch(i * nt + j + 1);
+            Pin p(store, i * nt + j, Access::Read);
+            std::size_t rows = std::min(t, n - i * t), cols = std::min(t, n - j * t);
+            for (std::size_t r = 0; r < rows; ++r)
+                std::copy(p.data() + r * t, p.data() + r * t + cols, out + (i * t + r) * n + j * t);
+        }
+}
+
+SquareMat TiledMat::toSquareMat() const {
+    SquareMat M(n);
+    double* out = M.data();
+    for (std::size_t i = 0; i < nt; ++i)
+        for (std::size_t j = 0; j < nt; ++j) {
+            store->prefetch(i * nt + j + 1);
+            Pin p(store, i * nt + j, Access::Read);
+            std::size_t rows = std::min(t, n - i * t), cols = std::min(t, n - j * t);
+            for (std::size_t r = 0; r < rows; ++r)
+                std::copy(p.data() + r * t, p.data() + r * t + cols, out + (i * t + r) * n + j * t);
+        }
+    return M;
+}
+
+// ======= Access =======
+
+double TiledMat::get(std::size_t i, std::size_t j) const {
+    if (i >= n || j >= n) throw std::out_of_range("index");
+    Pin p(store, (i / t) * nt + j / t, Access::Read);
+    return p.data()[(i % t) * t + j % t];
+}
+
+void TiledMat::set(std::size_t i, std::size_t j, double v) {
+    if (i >= n || j >= n) throw std::out_of_range("index");
+    Pin p(store, (i / t) * nt + j / t, Access::Update);
+    p.data()[(i % t) * t + j % t] = v;
+}
+
+// ======= Operators =======
+
+TiledMat operator+(const TiledMat& A, const TiledMat& B) {
+    ensureSame(A, B);
+    TiledMat C(A.n, A.cfg);
+    const detail::KernelTable& k = detail::kernels();
+    for (std::size_t x = 0; x < A.nt * A.nt; ++x) {
+        A.store->prefetch(x + 1);
+        B.store->prefetch(x + 1);
+        Pin a(A.store, x, Access::Read), b(B.store, x, Access::Read);
+        Pin c(C.store, x, Access::Overwrite);
+        k.add(a.data(), b.data(), c.data(), A.t * A.t);
+    }
+    return C;
+}
+
+TiledMat operator-(const TiledMat& A, const TiledMat& B) {
+    ensureSame(A, B);
+    TiledMat C(A.n, A.cfg);
+    const detail::KernelTable& k = detail::kernels();
+    for (std::size_t x = 0; x < A.nt * A.nt; ++x) {
+        A.store->prefetch(x + 1);
+        B.store->prefetch(x + 1);
+        Pin a(A.store, x, Access::Read), b(B.store, x, Access::Read);
+        Pin c(C.store, x, Access::Overwrite);
+        k.sub(a.data(), b.data(), c.data(), A.t * A.t);
+    }
+    return C;
+}
+
+TiledMat operator*(const TiledMat& A, double s) {
+    TiledMat C(A.n, A.cfg);
+    const detail::KernelTable& k = detail::kernels();
+    for (std::size_t x = 0; x < A.nt * A.nt; ++x) {
+        A.store->prefetch(x + 1);
+        Pin a(A.store, x, Access::Read);
+        Pin c(C.store, x, Access::Overwrite);
+        k.scale(a.data(), s, c.data(), A.t * A.t);
+    }
+    return C;
+}
+
+// C_ij = sum_k A_ik B_kj, one output tile at a time. The k order alternates
+// between output tiles, so the tiles of A's row used last are used first
+// again while still cached; the next pair is queued before each product.
+TiledMat operator*(const TiledMat& A, const TiledMat& B) {
+    ensureSame(A, B);
+    std::size_t nt = A.nt, t = A.t;
+    TiledMat C(A.n, A.cfg);
+    for (std::size_t i = 0; i < nt; ++i)
+        for (std::size_t j = 0; j < nt; ++j) {
+            bool down = (i * nt + j) % 2 == 1;
+            Pin c(C.store, i * nt + j, Access::Overwrite);
+            for (std::size_t s = 0; s < nt; ++s) {
+                std::size_t k = down ? nt - 1 - s : s;
+                if (s + 1 < nt) {
+                    std::size_t next = down ? k - 1 : k + 1;
+                    A.store->prefetch(i * nt + next);
+                    B.store->prefetch(next * nt + j);
+                }
+                Pin a(A.store, i * nt + k, Access::Read), b(B.store, k * nt + j, Access::Read);
+                detail::gemm(t, t, t, 1.0, a.data(), t, false, b.data(), t, false,
+                             s == 0 ? 0.0 : 1.0, c.data(), t);
+            }
+        }
+    return C;
+}
+
+TiledMat TiledMat::operator~() const {
+    TiledMat C(n, cfg);
+    const detail::KernelTable& k = detail::kernels();
+    for (std::size_t i = 0; i < nt; ++i)
+        for (std::size_t j = 0; j < nt; ++j) {
+            store->prefetch(j + 1 < nt ? (j + 1) * nt + i : i + 1);   // the next source tile
+            Pin a(store, j * nt + i, Access::Read);
+            Pin c(C.store, i * nt + j, Access::Overwrite);
+            k.transpose(a.data(), t, c.data(), t, t, t);
+        }
+    return C;
+}
+
+double TiledMat::operator!() const {
+    if (n == 0) throw std::logic_error("det of empty matrix");
+    Factorization f = factorTiles(store, n, t, nt);
+    if (f.singular) return 0;
+    double d = f.sign * f.det;
+    return std::fabs(d) < SquareMat::EPS ? 0.0 : d;
+}
+
+double TiledMat::logAbsDet() const {
+    if (n == 0) throw std::logic_error("det of empty matrix");
+    Factorization f = factorTiles(store, n, t, nt);
+    return f.singular ? -std::numeric_limits<double>::infinity() : f.logAbs;
+}
+
+double TiledMat::sum() const {
+    const detail::KernelTable& k = detail::kernels();
+    double s = 0.0;
+    for (std::size_t x = 0; x < nt * nt; ++x) {
+        store->prefetch(x + 1);
+        Pin a(store, x, Access::Read);
+        s += k.sum(a.data(), t * t);
+    }
+    return s;
+}
+
+// ======= Cache =======
+
+TileStats TiledMat::stats() const {
+    return store->stats();
+}
+
+void TiledMat::flush() {
+    store->flush();
+}
+
+} // namespace MatrixLib
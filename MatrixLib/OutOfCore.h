@@ -0,0 +1,119 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_OUTOFCORE_H
+#define MATRIXLIB_OUTOFCORE_H
+
+#include <cstddef>      // for size_t
+#include <string>       // for paths
+#include "SquareMat.h"
+
+namespace MatrixLib {
+
+// ===== Out-of-Core Matrix =====
+//
+// TiledMat keeps an n x n matrix on disk as tile x tile blocks (row-major
+// inside a tile, edge tiles zero-padded) in an unlinked temporary file, and
+// holds at most `budget` bytes of tiles in memory. Tiles move through an LRU
+// cache: dirty tiles are written back on eviction, and the operators queue
+// the next tiles they need to a background thread that reads them ahead of
+// use. Every operation walks the tiles in a fixed order and computes with the
+// in-memory kernels (GEMM, element-wise tables), so results do not depend on
+// the budget or the thread count.
+//
+// Orders up to what the disk holds work. A product reads each tile of B once
+// per tile row of A (the k order alternates so the row of A stays cached);
+// the determinant is a left-looking LU that reads every earlier tile column
+// once per column. Its factor tiles go through the matrix's own cache, so the
+// budget holds there too, but one tile column stays pinned per step: the
+// budget must fit order / tile + 2 tiles (std::logic_error otherwise). Outside
+// the cache it needs two tile buffers and two indices per row.
+// POSIX only (pread / pwrite); std::runtime_error on I/O failures.
+
+constexpr std::size_t TILE_ORDER = 512;                          // 2 MB tiles
+constexpr std::size_t TILE_BUDGET = std::size_t(256) << 20;     // bytes of cached tiles
+
+struct TiledConfig {
+    std::size_t tile = TILE_ORDER;      // tile order
+    std::size_t budget = TILE_BUDGET;   // cache size in bytes (at least 4 tiles; ! needs a tile column + 2)
+    std::string dir;                    // tile file directory (empty: $TMPDIR or /tmp)
+};
+
+// cache counters of one matrix
+struct TileStats {
+    std::size_t hits;        // tile found in memory
+    std::size_t misses;      // tile had to be read (or claimed for overwrite)
+    std::size_t reads;       // tiles read from disk (prefetches included)
+    std::size_t writes;      // dirty tiles written back
+    std::size_t prefetched;  // tiles read ahead by the background thread
+    std::size_t resident;    // tiles in memory now
+    std::size_t capacity;    // tiles the budget holds
+};
+
+namespace detail {
+class TileStore;   // tile file + LRU cache + prefetch thread (OutOfCore.cpp)
+}
+
+class TiledMat {
+    std::size_t n;              // order
+    std::size_t t;              // tile order
+    std::size_t nt;             // tiles per side
+    TiledConfig cfg;
+    detail::TileStore* store;
+
+public:
+    // ===== Rule of Five =====
+
+    // order x order matrix with every element initVal
+    explicit TiledMat(std::size_t order, const TiledConfig& config = TiledConfig(), double initVal = 0.0);
+
+    // copy of an in-memory (or mapped) matrix
+    explicit TiledMat(const SquareMat& m, const TiledConfig& config = TiledConfig());
+
+    TiledMat(const TiledMat& other);
+    TiledMat& operator=(const TiledMat& other);
+    TiledMat(TiledMat&& other) noexcept;
+    TiledMat& operator=(TiledMat&& other) noexcept;
+    ~TiledMat();
+
+    // ===== Files =====
+
+    // Stream a matrix file (MatFile.h format) in through a private mapping, so
+    // the source never has to fit in memory; save() writes one the same way
+    static TiledMat load(const std::string& path, const TiledConfig& config = TiledConfig());
+    void save(const std::string& path) const;
+
+    // the whole matrix in memory
+    SquareMat toSquareMat() const;
+
+    // ===== Access =====
+
+    [[nodiscard]] std::size_t order() const { return n; }
+    [[nodiscard]] std::size_t tileOrder() const { return t; }
+    const TiledConfig& config() const { return cfg; }
+
+    // one element (loads its tile; checked against the order)
+    double get(std::size_t i, std::size_t j) const;
+    void set(std::size_t i, std::size_t j, double v);
+
+    // ===== Operators =====
+    // Results use the left operand's configuration
+
+    friend TiledMat operator+(const TiledMat& A, const TiledMat& B);
+    friend TiledMat operator-(const TiledMat& A, const TiledMat& B);
+    friend TiledMat operator*(const TiledMat& A, const TiledMat& B);
+    friend TiledMat operator*(const TiledMat& A, double s);
+    friend TiledMat operator*(double s, const TiledMat& A) { return A * s; }
+
+    TiledMat operator~() const;     // transpose
+    double operator!() const;       // determinant (0 when a pivot is below EPS, like LU)
+    double logAbsDet() const;       // log |det| (-inf when singular)
+    double sum() const;             // sum of all elements, tile by tile in order
+
+    // ===== Cache =====
+
+    TileStats stats() const;
+    void flush();                   // write dirty tiles back now
+};
+
+} // namespace MatrixLib
+#endif
@@ -1,280 +1,571 @@
 // eitan.derdiger@gmail.com
 
 #include "SquareMat.h"
-#include <algorithm>   // for std::swap
-#include <cmath>       // for fmod, fabs
+#include "LU.h"
+#include "FixedSquareMat.h"
+#include "Strassen.h"
+#include "Gemm.h"
+#include "Alloc.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include <algorithm>   // for std::swap, std::fill, std::copy
+#include <utility>     // for std::move
+#include <cmath>       // for fmod, fabs, sqrt
 
 using namespace MatrixLib;
 
+namespace {
+
+using detail::PAR_GRAIN;
+
+// sum() always folds partial sums of this many elements, whatever the thread count
+constexpr std::size_t SUM_CHUNK = std::size_t(1) << 14;
+
+// leaf size of SumMode::Pairwise (one 16-lane kernel call per leaf)
+constexpr std::size_t PAIRWISE_BLOCK = 256;
+
+// upper bound on row bands (and column-sum buffers) in summary()
+constexpr std::size_t SUMMARY_BANDS = 64;
+
+// reduction partials from the pool, freed on every exit path
+struct Partials {
+    double* p;
+    std::size_t len;
+
+    explicit Partials(std::size_t count) : p(detail::allocDoubles(count)), len(count) {}
+    ~Partials() { detail::freeDoubles(p, len); }
+    Partials(const Partials&) = delete;
+    Partials& operator=(const Partials&) = delete;
+};
+
+// balanced pairwise sum of p[0..count)
+double pairwise(const double* p, std::size_t count) {
+    if (count == 1) return p[0];
+    std::size_t h = count / 2;
+    return pairwise(p, h) + pairwise(p + h, count - h);
+}
+
+// Run f(begin, end) over [0, len) split into PAR_GRAIN-sized pieces on the pool
+template <class F>
+void forBlocks(std::size_t len, F f) {
+    ThreadPool::instance().parallelFor(len, PAR_GRAIN, f);
+}
+
+using BinaryKernel = void (*)(const double*, const double*, double*, std::size_t);
+using ScalarKernel = void (*)(const double*, double, double*, std::size_t);
+
+// out = a (op) b over len elements; out may alias a or b
+void applyBinary(BinaryKernel k, const double* a, const double* b, double* out, std::size_t len) {
+    forBlocks(len, [&](std::size_t i, std::size_t e) { k(a + i, b + i, out + i, e - i); });
+}
+
+// out = a (op) s over len elements; out may alias a
+void applyScalar(ScalarKernel k, const double* a, double s, double* out, std::size_t len) {
+    forBlocks(len, [&](std::size_t i, std::size_t e) { k(a + i, s, out + i, e - i); });
+}
+
+// d = d mod m (result in [0, |m|) for positive m), in place
+void modInPlace(double* d, std::size_t len, int m) {
+    forBlocks(len, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; ++i) {
+            d[i] = std::fmod(d[i], static_cast<double>(m));
+            if (d[i] < 0) d[i] += m;
+        }
+    });
+}
+
+// C = op(A) * op(B) for n x n row-major buffers (C must not alias A or B)
+// Large orders go through the blocked GEMM engine, which packs transposed
+// operands straight from their buffers; small ones use direct loops. With
+// setStrassen on, untransposed products above the crossover recurse first.
+void multiplyInto(const double* A, const double* B, double* C, std::size_t n,
+                  bool transA = false, bool transB = false) {
+    std::size_t cut = detail::strassenCrossover();
+    if (cut && n > cut && !transA && !transB) {
+        detail::strassenMultiply(n, A, n, B, n, C, n, cut);
+        return;
+    }
+    if (n >= detail::GEMM_THRESHOLD) {
+        detail::gemm(n, n, n, 1.0, A, n, transA, B, n, transB, 0.0, C, n);
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        double* c = C + i * n;
+        if (transB) {
+            // row j of B is column j of op(B): dot products along contiguous rows
+            for (std::size_t j = 0; j < n; ++j) {
+                const double* b = B + j * n;
+                double acc = 0.0;
+                for (std::size_t k = 0; k < n; ++k)
+                    acc += (transA ? A[k * n + i] : A[i * n + k]) * b[k];
+                c[j] = acc;
+            }
+            continue;
+        }
+        std::fill(c, c + n, 0.0);
+        for (std::size_t k = 0; k < n; ++k) {
+            double aik = transA ? A[k * n + i] : A[i * n + k];
+            const double* b = B + k * n;
+            for (std::size_t j = 0; j < n; ++j)
+                c[j] += aik * b[j];
+        }
+    }
+}
+
+// side of the square tiles handed to the SIMD transpose kernel (a tile pair fits in L1)
+constexpr std::size_t TRANSPOSE_TILE = 32;
+
+// Cache-oblivious transpose of src rows [r0, r1) x cols [c0, c1) into dst:
+// halve the longer side until the block is one tile, then shuffle it in registers
+void transposeRec(const double* src, double* dst, std::size_t n,
+                  std::size_t r0, std::size_t r1, std::size_t c0, std::size_t c1) {
+    std::size_t rows = r1 - r0, cols = c1 - c0;
+    if (rows <= TRANSPOSE_TILE && cols <= TRANSPOSE_TILE) {
+        detail::kernels().transpose(src + r0 * n + c0, n, dst + c0 * n + r0, n, rows, cols);
+    } else if (rows >= cols) {
+        std::size_t mid = r0 + rows / 2;
+        transposeRec(src, dst, n, r0, mid, c0, c1);
+        transposeRec(src, dst, n, mid, r1, c0, c1);
+    } else {
+        std::size_t mid = c0 + cols / 2;
+        transposeRec(src, dst, n, r0, r1, c0, mid);
+        transposeRec(src, dst, n, r0, r1, mid, c1);
+    }
+}
+
+// dst = src^T for n x n buffers (dst must not alias src); row bands go to the pool
+void transposeInto(const double* src, double* dst, std::size_t n) {
+    ThreadPool::instance().parallelFor(n, n ? PAR_GRAIN / n : 1, [&](std::size_t i0, std::size_t i1) {
+        transposeRec(src, dst, n, i0, i1, 0, n);
+    });
+}
+
+// Per-thread scratch buffer for operator*=. After each product it holds the
+// matrix's previous buffer, so repeated *= at one order never allocates.
+struct Workspace {
+    double* buf = nullptr;
+    std::size_t len = 0;
+
+    ~Workspace() { detail::freeDoubles(buf, len); }
+
+    // exactly `need` elements, so the buffer can trade places with a matrix's
+    double* get(std::size_t need) {
+        if (len != need) {
+            detail::freeDoubles(buf, len);
+            buf = nullptr;
+            len = 0;
+            buf = detail::allocDoubles(need);
+            len = need;
+        }
+        return buf;
+    }
+};
+
+thread_local Workspace mulWorkspace;
+
+} // namespace
+
 // ======= Constructors =======
 
 // Initialize a square matrix with given size and fill value
 SquareMat::SquareMat(std::size_t order, double initVal)
-    : n(order), data(nullptr) {
+    : n(order), elems(nullptr) {
     if (n == 0 && initVal != 0.0)
         throw std::invalid_argument("order 0 with value");
     if (n) {
-        data = new double[n * n]; // allocate memory
+        elems = acquire(n); // inline or heap
         for (std::size_t i = 0; i < n * n; ++i)
-            data[i] = initVal; // fill all cells
+            elems[i] = initVal; // fill all cells
     }
 }
 
+// Allocate without filling (private; callers overwrite every element)
+SquareMat::SquareMat(std::size_t order, Uninit)
+    : n(order), elems(acquire(order)) {}
+
 // Initialize matrix from initializer list (like {{1,2},{3,4}})
 SquareMat::SquareMat(std::initializer_list<std::initializer_list<double>> init)
-    : n(init.size()), data(nullptr) {
+    : n(init.size()), elems(nullptr) {
     if (n == 0)
         throw std::invalid_argument("empty init");
 
-    data = new double[n * n];
+    elems = acquire(n);
     std::size_t r = 0;
     for (const auto& row : init) {
-        if (row.size() != n)
+        if (row.size() != n) {
+            release();
             throw std::invalid_argument("not square");
+        }
         std::size_t c = 0;
         for (double v : row)
-            data[idx(r, c++)] = v; // copy values
+            elems[idx(r, c++)] = v; // copy values
         ++r;
     }
 }
 
+// Take over other's cached sum (same elements, same bits)
+void SquareMat::copySumFrom(const SquareMat& other) {
+    if (other.sumValid.load(std::memory_order_acquire)) {
+        sumCache.store(other.sumCache.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        sumValid.store(true, std::memory_order_release);
+    } else {
+        dirty();
+    }
+}
+
 // Deep copy constructor
 SquareMat::SquareMat(const SquareMat& other)
-    : n(other.n), data(nullptr) {
-    if (n) {
-        data = new double[n * n];
-        std::copy(other.data, other.data + n * n, data);
+    : n(other.n), elems(acquire(other.n)) {
+    std::copy(other.elems, other.elems + n * n, elems);
+    copySumFrom(other);
+}
+
+// Move constructor - steals a heap buffer (inline elements are copied), leaves other empty
+SquareMat::SquareMat(SquareMat&& other) noexcept
+    : n(other.n), elems(other.elems), map(other.map) {
+    if (other.isInline()) {
+        elems = local;
+        std::copy(other.local, other.local + n * n, local);
     }
+    copySumFrom(other);
+    other.n = 0;
+    other.elems = nullptr;
+    other.map = nullptr;
+    other.dirty();
 }
 
-// Assignment operator using copy-and-swap idiom
+// Copy assignment - same order copies into our storage, otherwise copy then move in
 SquareMat& SquareMat::operator=(const SquareMat& other) {
     if (this == &other) return *this;
-    SquareMat tmp(other);
-    std::swap(n, tmp.n);
-    std::swap(data, tmp.data);
+    if (n != other.n) return *this = SquareMat(other);
+    std::copy(other.elems, other.elems + n * n, elems);
+    copySumFrom(other);
     return *this;
 }
 
-// Destructor - frees memory
-SquareMat::~SquareMat() {
-    delete[] data;
+// Move assignment - releases our buffer and steals other's (a mapped matrix
+// of the same order keeps its file and copies the elements in)
+SquareMat& SquareMat::operator=(SquareMat&& other) noexcept {
+    if (this == &other) return *this;
+    if (map && n == other.n) {
+        std::copy(other.elems, other.elems + n * n, elems);
+        copySumFrom(other);
+        return *this;
+    }
+    release();
+    n = other.n;
+    elems = other.elems;
+    map = other.map;
+    if (other.isInline()) {
+        elems = local;
+        std::copy(other.local, other.local + n * n, local);
+    }
+    copySumFrom(other);
+    other.n = 0;
+    other.elems = nullptr;
+    other.map = nullptr;
+    other.dirty();
+    return *this;
 }
 
-// ======= Element Access =======
-
-// Access row as array (non-const)
-double* SquareMat::operator[](std::size_t row) {
-    if (row >= n) throw std::out_of_range("row");
-    return data + row * n;
+// Three moves: pointer steals for heap buffers, element copies for inline ones
+void SquareMat::swap(SquareMat& other) noexcept {
+    if (this == &other) return;
+    SquareMat t(std::move(other));
+    other = std::move(*this);
+    *this = std::move(t);
 }
 
-// Access row as array (const version)
-const double* SquareMat::operator[](std::size_t row) const {
-    if (row >= n) throw std::out_of_range("row");
-    return data + row * n;
+// Destructor - frees memory
+SquareMat::~SquareMat() {
+    release();
 }
 
-// ======= Sum of Elements =======
+// ======= Reductions =======
 
 // Calculate sum of all elements in matrix
+// Fixed SUM_CHUNK partials are reduced in order, so the result is the same on any thread count.
+// The result is cached until the next non-const operation.
 double SquareMat::sum() const {
+    if (sumValid.load(std::memory_order_acquire))
+        return sumCache.load(std::memory_order_relaxed);
+
+    std::size_t len = n * n;
     double s = 0;
-    for (std::size_t i = 0; i < n * n; ++i)
-        s += data[i];
+    if (len <= SUM_CHUNK) {
+        s = detail::kernels().sum(elems, len);
+    } else {
+        std::size_t chunks = (len + SUM_CHUNK - 1) / SUM_CHUNK;
+        Partials buf(chunks);
+        double* partial = buf.p;
+        ThreadPool::instance().parallelFor(chunks, PAR_GRAIN / SUM_CHUNK, [&](std::size_t c0, std::size_t c1) {
+            for (std::size_t c = c0; c < c1; ++c) {
+                std::size_t b = c * SUM_CHUNK;
+                partial[c] = detail::kernels().sum(elems + b, std::min(SUM_CHUNK, len - b));
+            }
+        });
+        for (std::size_t c = 0; c < chunks; ++c)
+            s += partial[c];
+    }
+
+    // concurrent const callers compute the same bits, so racing stores agree
+    sumCache.store(s, std::memory_order_relaxed);
+    sumValid.store(true, std::memory_order_release);
     return s;
 }
 
 
-// ======= Free Functions / Operators =======
-namespace MatrixLib {
+// Pairwise: 16-lane sums of PAIRWISE_BLOCK blocks (on the pool), then a
+// balanced tree over the block sums
+double SquareMat::sum(SumMode mode) const {
+    if (mode == SumMode::Fast) return sum();
+    std::size_t len = n * n;
+    if (len == 0) return 0;
 
-// Check if matrices have same size
-void ensure_same(const SquareMat& a, const SquareMat& b) {
-    if (a.order() != b.order())
-        throw std::invalid_argument("order mismatch");
-}
+    if (mode == SumMode::Pairwise) {
+        std::size_t blocks = (len + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK;
+        Partials part(blocks);
+        ThreadPool::instance().parallelFor(blocks, PAR_GRAIN / PAIRWISE_BLOCK, [&](std::size_t b0, std::size_t b1) {
+            for (std::size_t b = b0; b < b1; ++b) {
+                std::size_t off = b * PAIRWISE_BLOCK;
+                part.p[b] = detail::kernels().sum(elems + off, std::min(PAIRWISE_BLOCK, len - off));
+            }
+        });
+        return pairwise(part.p, blocks);
+    }
 
-// Element-wise addition
-SquareMat operator+(const SquareMat& a, const SquareMat& b) {
-    ensure_same(a, b);
-    std::size_t n = a.order();
-    SquareMat r(n);
-    for (std::size_t i = 0; i < n * n; ++i)
-        r.data[i] = a.data[i] + b.data[i];
-    return r;
+    // Kahan: compensated SUM_CHUNK partials, added with compensation in order
+    if (len <= SUM_CHUNK) return detail::kernels().sumKahan(elems, len);
+    std::size_t chunks = (len + SUM_CHUNK - 1) / SUM_CHUNK;
+    Partials part(chunks);
+    ThreadPool::instance().parallelFor(chunks, PAR_GRAIN / SUM_CHUNK, [&](std::size_t c0, std::size_t c1) {
+        for (std::size_t c = c0; c < c1; ++c) {
+            std::size_t b = c * SUM_CHUNK;
+            part.p[c] = detail::kernels().sumKahan(elems + b, std::min(SUM_CHUNK, len - b));
+        }
+    });
+    return detail::kernels().sumKahan(part.p, chunks);
 }
 
-// Element-wise subtraction
-SquareMat operator-(const SquareMat& a, const SquareMat& b) {
-    ensure_same(a, b);
-    std::size_t n = a.order();
-    SquareMat r(n);
-    for (std::size_t i = 0; i < n * n; ++i)
-        r.data[i] = a.data[i] - b.data[i];
-    return r;
+double SquareMat::trace() const {
+    double t = 0;
+    for (std::size_t i = 0; i < n; ++i) t += elems[i * n + i];
+    return t;
 }
 
-// Matrix multiplication
-SquareMat operator*(const SquareMat& A, const SquareMat& B) {
-    ensure_same(A, B);
-    std::size_t n = A.order();
-    SquareMat C(n, 0.0);
-    for (std::size_t i = 0; i < n; ++i)
-        for (std::size_t k = 0; k < n; ++k) {
-            double aik = A[i][k];
-            for (std::size_t j = 0; j < n; ++j)
-                C[i][j] += aik * B[k][j];
+// One pass: each row goes through the stats kernel (|a| row sum, a^2, min,
+// max) and adds |a| into column sums while it is still in L1. Row bands are
+// fixed by n alone and combined in order, so any thread count gives the same bits.
+SquareMat::Summary SquareMat::summary() const {
+    if (n == 0) throw std::logic_error("summary of empty matrix");
+    std::size_t bands = std::min(SUMMARY_BANDS, (n * n + PAR_GRAIN - 1) / PAR_GRAIN);
+    std::size_t rowsPer = (n + bands - 1) / bands;
+    bands = (n + rowsPer - 1) / rowsPer;
+
+    Partials cols(bands * n), stats(4 * bands);
+    double* colAbs = cols.p;   // |a| column sums per band
+    std::fill(colAbs, colAbs + bands * n, 0.0);
+    double* bandMin = stats.p;   // per band: min, max, normInf, sum a^2
+    double* bandMax = bandMin + bands;
+    double* bandInf = bandMax + bands;
+    double* bandSq = bandInf + bands;
+    ThreadPool::instance().parallelFor(bands, 1, [&](std::size_t b0, std::size_t b1) {
+        for (std::size_t b = b0; b < b1; ++b) {
+            detail::RowStats acc{0, 0, elems[b * rowsPer * n], elems[b * rowsPer * n]};
+            double rowMax = 0;
+            for (std::size_t i = b * rowsPer; i < std::min(n, (b + 1) * rowsPer); ++i) {
+                detail::RowStats r;
+                detail::kernels().stats(elems + i * n, n, r);
+                detail::kernels().addAbs(elems + i * n, colAbs + b * n, n);
+                rowMax = std::max(rowMax, r.sumAbs);
+                acc.sumSq += r.sumSq;
+                acc.min = std::min(acc.min, r.min);
+                acc.max = std::max(acc.max, r.max);
+            }
+            bandMin[b] = acc.min;
+            bandMax[b] = acc.max;
+            bandInf[b] = rowMax;
+            bandSq[b] = acc.sumSq;
         }
-    return C;
-}
-
-// Scalar multiplication (scalar * matrix)
-SquareMat operator*(double s, const SquareMat& M) {
-    SquareMat R(M.order());
-    for (std::size_t i = 0; i < M.order() * M.order(); ++i)
-        R.data[i] = s * M.data[i];
-    return R;
+    });
+
+    Summary out{bandMin[0], bandMax[0], 0, 0, 0};
+    double sumSq = 0;
+    for (std::size_t b = 0; b < bands; ++b) {
+        out.min = std::min(out.min, bandMin[b]);
+        out.max = std::max(out.max, bandMax[b]);
+        out.normInf = std::max(out.normInf, bandInf[b]);
+        sumSq += bandSq[b];
+        if (b > 0) detail::kernels().add(colAbs, colAbs + b * n, colAbs, n);
+    }
+    for (std::size_t j = 0; j < n; ++j) out.norm1 = std::max(out.norm1, colAbs[j]);
+    out.normFrobenius = std::sqrt(sumSq);
+    return out;
 }
 
-// Scalar multiplication (matrix * scalar)
-SquareMat operator*(const SquareMat& M, double s) {
-    return s * M;
-}
+// ======= Free Functions / Operators =======
+namespace MatrixLib {
 
-// Division by scalar
-SquareMat operator/(const SquareMat& M, double s) {
-    if (std::fabs(s) < SquareMat::EPS)
-        throw std::invalid_argument("divide by 0");
-    SquareMat R(M.order());
-    for (std::size_t i = 0; i < M.order() * M.order(); ++i)
-        R.data[i] = M.data[i] / s;
-    return R;
+// Check if matrices have same size
+void ensure_same(const SquareMat& a, const SquareMat& b) {
+    if (a.order() != b.order())
+        throw std::invalid_argument("order mismatch");
 }
 
-// Element-wise multiplication
-SquareMat operator%(const SquareMat& A, const SquareMat& B) {
+// Matrix multiplication, optionally with transposed operands
+SquareMat multiply(const SquareMat& A, const SquareMat& B, bool transA, bool transB) {
     ensure_same(A, B);
-    SquareMat R(A.order());
-    for (std::size_t i = 0; i < A.order() * A.order(); ++i)
-        R.data[i] = A.data[i] * B.data[i];
-    return R;
+    SquareMat C(A.order(), SquareMat::Uninit{});
+    multiplyInto(A.elems, B.elems, C.elems, C.n, transA, transB);
+    return C;
 }
 
 // Element-wise modulo with integer
 SquareMat operator%(const SquareMat& M, int m) {
+    return SquareMat(M) % m;
+}
+SquareMat operator%(SquareMat&& M, int m) {
     if (m == 0)
         throw std::invalid_argument("mod 0");
-    SquareMat R(M.order());
-    for (std::size_t i = 0; i < M.order() * M.order(); ++i) {
-        R.data[i] = std::fmod(M.data[i], static_cast<double>(m));
-        if (R.data[i] < 0) R.data[i] += m;
-    }
-    return R;
-}
-
-// Print matrix nicely
-std::ostream& operator<<(std::ostream& os, const SquareMat& M) {
-    std::size_t n = M.order();
-    for (std::size_t i = 0; i < n; ++i) {
-        os << "[ ";
-        for (std::size_t j = 0; j < n; ++j) {
-            os << M.data[i * n + j];
-            if (j + 1 < n) os << ", ";
-        }
-        os << " ]\n";
-    }
-    return os;
-}
-
-// Same as <<
-std::ostream& operator>>(std::ostream& os, const SquareMat& M) {
-    return operator<<(os, M);
+    M.dirty();
+    modInPlace(M.elems, M.n * M.n, m);
+    return std::move(M);
 }
 
 } // namespace MatrixLib
 
 // ======= Unary Operators / Transpose / Power =======
 
-// Negate all elements
-SquareMat SquareMat::operator-() const {
-    SquareMat R(n);
-    for (std::size_t i = 0; i < n * n; ++i)
-        R.data[i] = -data[i];
-    return R;
+// Transpose the matrix (lazy: products consume it without materializing)
+TransposeExpr<SquareMat> SquareMat::operator~() const {
+    return TransposeExpr<SquareMat>(*this);
+}
+
+// Materialize a transpose
+SquareMat::SquareMat(const TransposeExpr<SquareMat>& t)
+    : SquareMat(t.order(), Uninit{}) {
+    transposeInto(t.operand().elems, elems, n);
 }
 
-// Transpose the matrix
-SquareMat SquareMat::operator~() const {
-    SquareMat R(n);
-    for (std::size_t i = 0; i < n; ++i)
-        for (std::size_t j = 0; j < n; ++j)
-            R.data[j * n + i] = data[i * n + j];
-    return R;
+// Assign a transpose (A = ~A is done in place)
+SquareMat& SquareMat::operator=(const TransposeExpr<SquareMat>& t) {
+    dirty();
+    if (&t.operand() == this)
+        return transposeInPlace();
+    if (t.order() != n)
+        return *this = SquareMat(t);
+    transposeInto(t.operand().elems, elems, n);
+    return *this;
+}
+
+// Transpose without allocating: tiles (I, J) and (J, I) are swapped across the
+// diagonal through one stack tile, each transposed by the SIMD kernel
+SquareMat& SquareMat::transposeInPlace() {
+    dirty();
+    const std::size_t T = TRANSPOSE_TILE;
+    std::size_t tiles = (n + T - 1) / T;
+    std::size_t grain = n * n < PAR_GRAIN ? tiles : 1;
+    ThreadPool::instance().parallelFor(tiles, grain, [&](std::size_t I0, std::size_t I1) {
+        double tmp[TRANSPOSE_TILE * TRANSPOSE_TILE];
+        for (std::size_t I = I0; I < I1; ++I) {
+            std::size_t r0 = I * T, rows = std::min(T, n - r0);
+            for (std::size_t J = I; J < tiles; ++J) {
+                std::size_t c0 = J * T, cols = std::min(T, n - c0);
+                double* upper = elems + r0 * n + c0;   // tile (I, J): rows x cols
+                double* lower = elems + c0 * n + r0;   // tile (J, I): cols x rows
+                detail::kernels().transpose(upper, n, tmp, T, rows, cols);
+                if (I != J)
+                    detail::kernels().transpose(lower, n, upper, n, cols, rows);
+                for (std::size_t j = 0; j < cols; ++j)
+                    std::copy(tmp + j * T, tmp + j * T + rows, lower + j * n);
+            }
+        }
+    });
+    return *this;
 }
 
 // Raise matrix to power k (k ≥ 0)
+// Iterative square-and-multiply over three fixed buffers (result, current
+// square, scratch) that trade places by swap, so the cost in
+// allocations is constant in k. Identity, diagonal and idempotent inputs
+// short-circuit.
 SquareMat SquareMat::operator^(unsigned int k) const {
     if (n == 0) throw std::logic_error("power of empty matrix");
     if (k == 0) {
         SquareMat I(n, 0.0);
         for (std::size_t i = 0; i < n; ++i)
-            I.data[i * n + i] = 1.0; // identity matrix
+            I.elems[i * n + i] = 1.0; // identity matrix
         return I;
     }
     if (k == 1) return *this;
-    SquareMat half = (*this) ^ (k / 2);
-    SquareMat res = half * half;
-    if (k % 2) res = res * (*this);
-    return res;
-}
 
-// Determinant using Gaussian Elimination
-double SquareMat::operator!() const {
-    if (n == 0) throw std::logic_error("det of empty matrix");
-
-    // Make a copy of the matrix to modify (we don't modify the original)
-    SquareMat A(*this);
-    
-    double det = 1.0;
-    // Perform Gaussian elimination
-    for (std::size_t i = 0; i < n; ++i) {
-        // Find the row with the largest pivot (for numerical stability)
-        std::size_t max_row = i;
-        for (std::size_t j = i + 1; j < n; ++j) {
-            if (std::fabs(A[j][i]) > std::fabs(A[max_row][i])) {
-                max_row = j;
-            }
+    bool diagonal = true, identity = true;
+    for (std::size_t i = 0; i < n && diagonal; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            double v = elems[i * n + j];
+            if (i != j && v != 0.0) { diagonal = identity = false; break; }
+            if (i == j && v != 1.0) identity = false;
         }
-
-        // Swap rows if necessary
-        if (i != max_row) {
-            for (std::size_t k = 0; k < n; ++k) {
-                std::swap(A[i][k], A[max_row][k]);
+    if (identity) return *this;
+    if (diagonal) {
+        // powers of the diagonal entries, same square-and-multiply scheme per entry
+        SquareMat D(n, 0.0);
+        for (std::size_t i = 0; i < n; ++i) {
+            double base = elems[i * n + i], r = 1.0;
+            for (unsigned int e = k; e; e >>= 1) {
+                if (e & 1) r *= base;
+                base *= base;
             }
-            det *= -1;  // Changing rows reverses the sign of the determinant
+            D.elems[i * n + i] = r;
         }
+        return D;
+    }
 
-        // If the pivot is basically zero, the determinant is zero
-        if (std::fabs(A[i][i]) < EPS) return 0;
-
-        // Eliminate all entries below the pivot
-        for (std::size_t j = i + 1; j < n; ++j) {
-            double factor = A[j][i] / A[i][i];
-            for (std::size_t k = i; k < n; ++k) {
-                A[j][k] -= factor * A[i][k];
+    std::size_t len = n * n;
+    SquareMat res(n, Uninit{}), sq(n, Uninit{}), tmp(n, Uninit{});
+    const double* base = elems;  // A^(2^i); starts as our own buffer
+    bool haveRes = false;
+    for (;;) {
+        if (k & 1) {
+            if (!haveRes) {
+                std::copy(base, base + len, res.elems);
+                haveRes = true;
+            } else {
+                multiplyInto(res.elems, base, tmp.elems, n);
+                res.swap(tmp);
             }
         }
-
-        // Multiply the determinant by the pivot element
-        det *= A[i][i];
+        k >>= 1;
+        if (!k) break;
+        multiplyInto(base, base, tmp.elems, n);
+        if (base == elems && std::equal(tmp.elems, tmp.elems + len, elems))
+            return *this;  // A^2 == A, so every power is A
+        sq.swap(tmp);
+        base = sq.elems;
     }
+    return res;
+}
 
-    if (std::fabs(det) < EPS) {
-        det = 0;
+// Determinant, dispatched by order: closed forms up to 4 x 4, elimination
+// unrolled for the exact order up to 8 (both on the stack), a one-shot LU
+// factorization above that (use LU directly to reuse the factors). The
+// eliminations read a pivot below EPS as singular; the closed forms have no
+// pivots, so only the final |det| < EPS test applies to them.
+double SquareMat::operator!() const {
+    double d;
+    switch (n) {
+        case 0: throw std::logic_error("det of empty matrix");
+        case 1: d = detail::detFixed<1>(elems); break;
+        case 2: d = detail::detFixed<2>(elems); break;
+        case 3: d = detail::detFixed<3>(elems); break;
+        case 4: d = detail::detFixed<4>(elems); break;
+        case 5: d = detail::detFixed<5>(elems); break;
+        case 6: d = detail::detFixed<6>(elems); break;
+        case 7: d = detail::detFixed<7>(elems); break;
+        case 8: d = detail::detFixed<8>(elems); break;
+        default: return LU(*this).det();
     }
-    
-    return det;
+    return std::fabs(d) < EPS ? 0.0 : d;
 }
 
 
@@ -282,8 +573,8 @@ double SquareMat::operator!() const {
 
 // Pre-increment
 SquareMat& SquareMat::operator++() {
-    for (std::size_t i = 0; i < n * n; ++i)
-        ++data[i];
+    dirty();
+    applyScalar(detail::kernels().addScalar, elems, 1.0, elems, n * n);
     return *this;
 }
 
@@ -296,8 +587,8 @@ SquareMat SquareMat::operator++(int) {
 
 // Pre-decrement
 SquareMat& SquareMat::operator--() {
-    for (std::size_t i = 0; i < n * n; ++i)
-        --data[i];
+    dirty();
+    applyScalar(detail::kernels().addScalar, elems, -1.0, elems, n * n);
     return *this;
 }
 
@@ -309,48 +600,60 @@ SquareMat SquareMat::operator--(int) {
 }
 
 // ======= Compound Assignment Operators =======
+// All of these update elems in place; none allocates a temporary matrix.
 
 SquareMat& SquareMat::operator+=(const SquareMat& rhs) {
-    return *this = *this + rhs;
+    dirty();
+    ensure_same(*this, rhs);
+    applyBinary(detail::kernels().add, elems, rhs.elems, elems, n * n);
+    return *this;
 }
 SquareMat& SquareMat::operator-=(const SquareMat& rhs) {
-    return *this = *this - rhs;
+    dirty();
+    ensure_same(*this, rhs);
+    applyBinary(detail::kernels().sub, elems, rhs.elems, elems, n * n);
+    return *this;
 }
+// The product lands in the thread's workspace, which then swaps buffers with us
+// (inline matrices use a stack scratch and copy back)
 SquareMat& SquareMat::operator*=(const SquareMat& rhs) {
-    return *this = *this * rhs;
+    dirty();
+    ensure_same(*this, rhs);
+    if (n == 0) return *this;
+    if (isInline()) {
+        double out[INLINE_CAP];
+        multiplyInto(elems, rhs.elems, out, n);
+        std::copy(out, out + n * n, elems);
+        return *this;
+    }
+    double* out = mulWorkspace.get(n * n);
+    multiplyInto(elems, rhs.elems, out, n);
+    if (map) std::copy(out, out + n * n, elems);   // mapped storage stays in place
+    else std::swap(elems, mulWorkspace.buf);
+    return *this;
 }
 SquareMat& SquareMat::operator*=(double s) {
-    for (std::size_t i = 0; i < n * n; ++i)
-        data[i] *= s;
+    dirty();
+    applyScalar(detail::kernels().scale, elems, s, elems, n * n);
     return *this;
 }
 SquareMat& SquareMat::operator/=(double s) {
-    return *this = *this / s;
+    dirty();
+    if (std::fabs(s) < EPS)
+        throw std::invalid_argument("divide by 0");
+    applyScalar(detail::kernels().div, elems, s, elems, n * n);
+    return *this;
 }
 SquareMat& SquareMat::operator%=(const SquareMat& rhs) {
-    return *this = *this % rhs;
+    dirty();
+    ensure_same(*this, rhs);
+    applyBinary(detail::kernels().mul, elems, rhs.elems, elems, n * n);
+    return *this;
 }
 SquareMat& SquareMat::operator%=(int m) {
-    return *this = *this % m;
-}
-
-// ======= Comparison Operators (based on sum) =======
-
-bool SquareMat::operator==(const SquareMat& rhs) const {
-    return std::fabs(sum() - rhs.sum()) < EPS;
-}
-bool SquareMat::operator!=(const SquareMat& rhs) const {
-    return !(*this == rhs);
-}
-bool SquareMat::operator< (const SquareMat& rhs) const {
-    return sum() < rhs.sum() - EPS;
-}
-bool SquareMat::operator<=(const SquareMat& rhs) const {
-    return *this < rhs || *this == rhs;
-}
-bool SquareMat::operator> (const SquareMat& rhs) const {
-    return rhs < *this;
-}
-bool SquareMat::operator>=(const SquareMat& rhs) const {
-    return rhs <= *this;
+    dirty();
+    if (m == 0)
+        throw std::invalid_argument("mod 0");
+    modInPlace(elems, n * n, m);
+    return *this;
 }
@@ -4,25 +4,76 @@
 #define MATRIXLIB_SQUAREMAT_H
 
 #include <cstddef>          // for size_t
-#include <iostream>         // for ostream
+#include <iostream>         // for ostream, istream
+#include <string_view>      // for parse
+#include <charconv>         // for to_chars_result
 #include <stdexcept>        // for exceptions
 #include <initializer_list> // for initializer_list
 #include <cmath>            // for fabs
+#include <atomic>           // for the cached sum
+#include "Config.h"         // MATRIXLIB_BOUNDS_CHECK, MATRIXLIB_INLINE_ORDER
+#include "Alloc.h"          // MATRIX_ALIGN
+#include "MatExpr.h"        // lazy element-wise expressions
+#include "MatFile.h"        // binary file format, MapMode
+#include <string>           // for file paths
 
 namespace MatrixLib {
 
-class SquareMat {
-    std::size_t n;     // size of matrix (n x n)
-    double* data;      // flat array for elements in row-major order
+// summation algorithm for SquareMat::sum(SumMode)
+enum class SumMode {
+    Fast,      // 16 SIMD lanes per chunk, chunks added in order (plain sum())
+    Pairwise,  // pairwise tree over small SIMD blocks: error grows with log(n^2)
+    Kahan      // compensated lanes and partials: error independent of n
+};
+
+struct StrassenReport;
+
+class SquareMat : public MatExpr<SquareMat> {
+public:
+    // orders stored inline (see MATRIXLIB_INLINE_ORDER)
+    static constexpr std::size_t INLINE_ORDER = MATRIXLIB_INLINE_ORDER;
 
-    // helper: convert (i, j) to linear index in data[]
+private:
+    static constexpr std::size_t INLINE_CAP = INLINE_ORDER ? INLINE_ORDER * INLINE_ORDER : 1;
+
+    std::size_t n;     // size of matrix (n x n)
+    double* elems;     // flat array for elements in row-major order (points at local when inline)
+    alignas(MATRIX_ALIGN) double local[INLINE_CAP];   // storage for orders 1..INLINE_ORDER
+    detail::FileMap* map = nullptr;                    // set when elems lives in a mapped file
+
+    // storage for an order-n matrix: the local array, a heap buffer, or nullptr for 0
+    double* acquire(std::size_t order) {
+        if (order == 0) return nullptr;
+        return order <= INLINE_ORDER ? local : detail::allocDoubles(order * order);
+    }
+    void release() {
+        if (map) detail::unmapFile(map);
+        else if (elems != local) detail::freeDoubles(elems, n * n);
+    }
+    bool isInline() const { return elems == local; }
+
+    // helper: convert (i, j) to linear index in elems[]
     inline std::size_t idx(std::size_t i, std::size_t j) const { return i * n + j; }
 
+    // Cached sum(): filled by the first sum() (any const caller may do it, hence
+    // atomic) and dropped by every non-const operation, so comparisons are O(1)
+    mutable std::atomic<double> sumCache{0.0};
+    mutable std::atomic<bool> sumValid{false};
+    void dirty() { sumValid.store(false, std::memory_order_relaxed); }
+    void copySumFrom(const SquareMat& other);
+
+    // allocate without filling (every element is written right after)
+    struct Uninit {};
+    SquareMat(std::size_t order, Uninit);
+
+    friend class LU;   // factors straight from / into the buffers
+    friend SquareMat strassen(const SquareMat&, const SquareMat&, StrassenReport*);
+
 public:
     // epsilon for floating-point comparisons
     static constexpr double EPS = 1e-9;
 
-    // ===== Rule of Three =====
+    // ===== Rule of Five =====
 
     // construct with size and optional initial value (default 0)
     explicit SquareMat(std::size_t order = 0, double initVal = 0.0);
@@ -36,52 +87,124 @@ public:
     // copy assignment operator
     SquareMat& operator=(const SquareMat& other);
 
-    // destructor
-    ~SquareMat();
+    // move constructor (takes the buffer - inline elements are copied - other becomes empty)
+    SquareMat(SquareMat&& other) noexcept;
 
-    // ===== Element Access =====
+    // move assignment operator (a mapped matrix of the same order copies, keeping its file)
+    SquareMat& operator=(SquareMat&& other) noexcept;
 
-    // access row i (modifiable)
-    double* operator[](std::size_t row);
+    // exchange contents (O(1) for heap buffers)
+    void swap(SquareMat& other) noexcept;
+    friend void swap(SquareMat& a, SquareMat& b) noexcept { a.swap(b); }
 
-    // access row i (read-only)
-    const double* operator[](std::size_t row) const;
+    // evaluate an element-wise expression (A + B % C - 2 * E) in one fused pass
+    template <class E>
+    SquareMat(const MatExpr<E>& expr);
 
-    // ===== External Binary Operators =====
+    // evaluate an expression into this matrix (reuses the buffer when orders match)
+    template <class E>
+    SquareMat& operator=(const MatExpr<E>& expr);
 
-    // matrix + matrix
-    friend SquareMat operator+(const SquareMat&, const SquareMat&);
+    // materialize a transpose (SquareMat B = ~A; A = ~A)
+    SquareMat(const TransposeExpr<SquareMat>& t);
+    SquareMat& operator=(const TransposeExpr<SquareMat>& t);
 
-    // matrix - matrix
-    friend SquareMat operator-(const SquareMat&, const SquareMat&);
+    // destructor
+    ~SquareMat();
 
-    // matrix * matrix
-    friend SquareMat operator*(const SquareMat&, const SquareMat&);
+    // ===== Element Access =====
+    //
+    // On a non-const matrix A[i] is a Row and A[i][j] an ElemRef: reading an
+    // element leaves the cached sum alone, writing one (=, +=, ++, ...) drops
+    // it. A Row used as a double* (double* p = A[i]) drops the cache when the
+    // pointer is taken, so like row_ptr() and data(), re-fetch a pointer kept
+    // across a later sum() or comparison before writing through it.
+
+    // one element of a non-const matrix (reads as a double)
+    class ElemRef {
+        SquareMat* m;
+        double* p;
+
+    public:
+        ElemRef(SquareMat* owner, double* elem) : m(owner), p(elem) {}
+        ElemRef(const ElemRef&) = default;
+        operator double() const { return *p; }
+
+        ElemRef& operator=(double v) { m->dirty(); *p = v; return *this; }
+        ElemRef& operator=(const ElemRef& o) { return *this = static_cast<double>(o); }
+        ElemRef& operator+=(double v) { m->dirty(); *p += v; return *this; }
+        ElemRef& operator-=(double v) { m->dirty(); *p -= v; return *this; }
+        ElemRef& operator*=(double v) { m->dirty(); *p *= v; return *this; }
+        ElemRef& operator/=(double v) { m->dirty(); *p /= v; return *this; }
+        ElemRef& operator++() { return *this += 1.0; }
+        ElemRef& operator--() { return *this -= 1.0; }
+        double operator++(int) { double old = *p; *this += 1.0; return old; }
+        double operator--(int) { double old = *p; *this -= 1.0; return old; }
+    };
+
+    // row i of a non-const matrix
+    class Row {
+        SquareMat* m;
+        double* p;
+
+    public:
+        Row(SquareMat* owner, double* row) : m(owner), p(row) {}
+        ElemRef operator[](std::size_t col) const { return ElemRef(m, p + col); }
+        operator double*() const { m->dirty(); return p; }   // raw writes: drop the cache now
+    };
+
+    // access row i (modifiable); checked unless MATRIXLIB_BOUNDS_CHECK is 0
+    Row operator[](std::size_t row) {
+        if (MATRIXLIB_BOUNDS_CHECK && row >= n) throw std::out_of_range("row");
+        return Row(this, elems + row * n);
+    }
 
-    // scalar * matrix
-    friend SquareMat operator*(double, const SquareMat&);
+    // access row i (read-only)
+    const double* operator[](std::size_t row) const {
+        if (MATRIXLIB_BOUNDS_CHECK && row >= n) throw std::out_of_range("row");
+        return elems + row * n;
+    }
+
+    // ===== Unchecked Access =====
+    //
+    // No bounds checks in any build: the caller guarantees i, j < order().
+    // The non-const forms drop the cached sum when called (like a Row used as a
+    // pointer), so re-fetch a pointer for writes made after a later sum() or
+    // comparison.
+
+    double& at_unchecked(std::size_t i, std::size_t j) { dirty(); return elems[idx(i, j)]; }
+    double  at_unchecked(std::size_t i, std::size_t j) const { return elems[idx(i, j)]; }
+
+    // start of row i (the row is order() contiguous elements)
+    double*       row_ptr(std::size_t i) { dirty(); return elems + i * n; }
+    const double* row_ptr(std::size_t i) const { return elems + i * n; }
+
+    // all size() elements, row-major and contiguous (nullptr when empty)
+    double*       data() { dirty(); return elems; }
+    const double* data() const { return elems; }
+    [[nodiscard]] std::size_t size() const { return n * n; }
 
-    // matrix * scalar
-    friend SquareMat operator*(const SquareMat&, double);
+    // ===== External Binary Operators =====
 
-    // matrix / scalar
-    friend SquareMat operator/(const SquareMat&, double);
+    // +, -, % (element-wise), scalar *, / and unary - are lazy; see MatExpr.h
 
-    // element-wise matrix % matrix
-    friend SquareMat operator%(const SquareMat&, const SquareMat&);
+    // op(A) * op(B), op = transpose when the flag is set; runs on the original
+    // buffers (operator* forwards here and passes ~X operands as flags)
+    friend SquareMat multiply(const SquareMat& A, const SquareMat& B, bool transA, bool transB);
 
     // matrix % scalar
     friend SquareMat operator%(const SquareMat&, int);
+    friend SquareMat operator%(SquareMat&&, int);
 
     // check size match before binary operations
     friend void ensure_same(const SquareMat&, const SquareMat&);
 
     // ===== Unary Operators =====
 
-    SquareMat operator-() const;                // negate elements
-    SquareMat operator~() const;                // transpose
+    TransposeExpr<SquareMat> operator~() const; // transpose (lazy)
+    SquareMat& transposeInPlace();              // transpose without allocating
     SquareMat operator^(unsigned int k) const;  // power (matrix^k)
-    double    operator!() const;                // determinant
+    double    operator!() const;                // determinant (closed forms to 4x4, else pivoted elimination; LU to reuse)
 
     // ===== Increment / Decrement =====
 
@@ -94,34 +217,217 @@ public:
 
     SquareMat& operator+=(const SquareMat&);
     SquareMat& operator-=(const SquareMat&);
+    template <class E> SquareMat& operator+=(const MatExpr<E>&);  // fused, in place
+    template <class E> SquareMat& operator-=(const MatExpr<E>&);
+    template <class E> SquareMat& operator%=(const MatExpr<E>&);
     SquareMat& operator*=(const SquareMat&);
     SquareMat& operator*=(double);
     SquareMat& operator/=(double);
     SquareMat& operator%=(const SquareMat&);
     SquareMat& operator%=(int);
 
-    // ===== Comparison Operators =====
-
-    bool operator==(const SquareMat&) const;  // same sum
-    bool operator!=(const SquareMat&) const;
-    bool operator< (const SquareMat&) const;  // based on sum
-    bool operator<=(const SquareMat&) const;
-    bool operator> (const SquareMat&) const;
-    bool operator>=(const SquareMat&) const;
-
     // ===== I/O Operators =====
+    //
+    // Text form: one "[ a, b, c ]" line per row, every element in the shortest
+    // form that reads back to the same double (std::to_chars), so printing and
+    // parsing round-trip exactly. Stream precision and flags are not used.
 
     friend std::ostream& operator<<(std::ostream&, const SquareMat&); // print matrix
     friend std::ostream& operator>>(std::ostream&, const SquareMat&); // alias for <<
 
+    // Read one matrix in the text form (the first row fixes the order, then
+    // that many rows). Bad input sets failbit and leaves the matrix unchanged.
+    friend std::istream& operator>>(std::istream&, SquareMat&);
+
+    // matrix from its text form; empty text is the empty matrix, anything
+    // malformed throws std::invalid_argument naming the offset
+    static SquareMat parse(std::string_view text);
+
+    // Write the text form into [first, last). Returns the end of the text, or
+    // {last, errc::value_too_large} if it does not fit (textBound() always does).
+    std::to_chars_result format(char* first, char* last) const;
+
+    // characters format() can need at most for this order
+    [[nodiscard]] std::size_t textBound() const;
+
+    // ===== Binary Files (format in MatFile.h) =====
+    //
+    // I/O failures throw std::runtime_error; a file that is not a valid matrix
+    // file (bad magic, version, type, size or checksum) std::invalid_argument.
+
+    // write header and elements (overwrites path)
+    void save(const std::string& path) const;
+
+    // read a file of either byte order into an ordinary matrix (checksum verified)
+    static SquareMat load(const std::string& path);
+
+    // Matrix whose elements are the file's payload, mapped in place: nothing is
+    // read until touched, and every operator works on it directly. Assignments
+    // of the same order (=, compound operators, *=) write into the mapping;
+    // results of other operators are ordinary matrices. The checksum is only
+    // verified when `verify` is set, as that reads the whole file.
+    static SquareMat mapFile(const std::string& path, MapMode mode = MapMode::Private,
+                             bool verify = false);
+
+    // storage is a mapped file
+    [[nodiscard]] bool isMapped() const { return map != nullptr; }
+
+    // Shared mapping: reseal the checksum and flush to disk, so the file loads
+    // again; writes after it need another sync() (no-op for other matrices)
+    void sync();
+
     // ===== Helpers =====
 
     // get matrix order (size n)
     [[nodiscard]] std::size_t order() const { return n; }
 
-    // sum of all elements
+    // ===== Reductions =====
+
+    // sum of all elements (cached until the matrix is modified)
     double sum() const;
+
+    // sum with a chosen algorithm (Fast is the same as sum())
+    double sum(SumMode mode) const;
+
+    // sum of the diagonal
+    double trace() const;
+
+    // every statistic below from a single pass over the matrix
+    struct Summary {
+        double min;
+        double max;
+        double norm1;           // max column sum of |a|
+        double normInf;         // max row sum of |a|
+        double normFrobenius;   // sqrt(sum of a^2)
+    };
+    Summary summary() const;    // throws std::logic_error on an empty matrix
+
+    double min() const { return summary().min; }
+    double max() const { return summary().max; }
+    double norm1() const { return summary().norm1; }
+    double normInf() const { return summary().normInf; }
+    double normFrobenius() const { return summary().normFrobenius; }
+
+    // ===== Expression Protocol (see MatExpr.h) =====
+
+    static constexpr bool reorders = false;
+    double evalAt(std::size_t i) const { return elems[i]; }
+    const double* evalBlock(std::size_t off, std::size_t, double*) const { return elems + off; }
+    bool uses(const SquareMat* m) const { return this == m; }
+};
+
+namespace detail {
+
+// the text form of an n x n row-major buffer (operator<< of both matrix types)
+std::ostream& writeText(std::ostream& os, const double* elems, std::size_t n);
+
+} // namespace detail
+
+// product entry point with optional transposed operands (no transpose is materialized)
+SquareMat multiply(const SquareMat& A, const SquareMat& B, bool transA = false, bool transB = false);
+
+// ===== Expression Evaluation =====
+
+template <class E>
+SquareMat::SquareMat(const MatExpr<E>& expr)
+    : SquareMat(expr.self().order(), Uninit{}) {
+    detail::evaluate(expr.self(), elems, n * n);
+}
+
+template <class E>
+SquareMat& SquareMat::operator=(const MatExpr<E>& expr) {
+    // a reordering expression that reads us (A = ~A + B) needs a fresh buffer
+    if (expr.self().order() != n || (E::reorders && expr.self().uses(this)))
+        return *this = SquareMat(expr.self());
+    dirty();
+    detail::evaluate(expr.self(), elems, n * n);
+    return *this;
+}
+
+template <class E>
+SquareMat& SquareMat::operator+=(const MatExpr<E>& e) { return *this = *this + e; }
+template <class E>
+SquareMat& SquareMat::operator-=(const MatExpr<E>& e) { return *this = *this - e; }
+template <class E>
+SquareMat& SquareMat::operator%=(const MatExpr<E>& e) { return *this = *this % e; }
+
+template <class E>
+double MatExpr<E>::sum() const {
+    return SquareMat(self()).sum();
+}
+
+// matrix / scalar
+template <class E>
+ScalarExpr<detail::DivOp, E> operator/(const MatExpr<E>& e, double s) {
+    if (std::fabs(s) < SquareMat::EPS)
+        throw std::invalid_argument("divide by 0");
+    return ScalarExpr<detail::DivOp, E>(e.self(), s);
+}
+
+// SquareMat operands pass through, expressions are evaluated first
+inline const SquareMat& materialize(const SquareMat& m) { return m; }
+template <class E>
+SquareMat materialize(const MatExpr<E>& e) { return SquareMat(e.self()); }
+
+namespace detail {
+
+// A product operand as multiply() sees it: a matrix, a transposed matrix
+// (passed as a flag), or any other expression evaluated into `owned`
+struct ProductOperand {
+    SquareMat owned;
+    const SquareMat* m;
+    bool trans;
+
+    ProductOperand(const SquareMat& x) : m(&x), trans(false) {}
+    ProductOperand(const TransposeExpr<SquareMat>& t) : m(&t.operand()), trans(true) {}
+    template <class E>
+    ProductOperand(const MatExpr<E>& e) : owned(e.self()), m(&owned), trans(false) {}
+
+    ProductOperand(const ProductOperand&) = delete;
+    ProductOperand& operator=(const ProductOperand&) = delete;
 };
 
+} // namespace detail
+
+// matrix * matrix; ~A * B, A * ~B and ~A * ~B use the fused transposed kernels
+template <class L, class R>
+SquareMat operator*(const MatExpr<L>& l, const MatExpr<R>& r) {
+    detail::ProductOperand a(l.self()), b(r.self());
+    return multiply(*a.m, *b.m, a.trans, b.trans);
+}
+
+// ===== Comparison Operators (based on sum) =====
+// O(1) on SquareMat operands once their sums are cached
+
+template <class L, class R>
+bool operator==(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return std::fabs(l.self().sum() - r.self().sum()) < SquareMat::EPS;
+}
+template <class L, class R>
+bool operator!=(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return !(l == r);
+}
+template <class L, class R>
+bool operator< (const MatExpr<L>& l, const MatExpr<R>& r) {
+    return l.self().sum() < r.self().sum() - SquareMat::EPS;
+}
+template <class L, class R>
+bool operator<=(const MatExpr<L>& l, const MatExpr<R>& r) {
+    double a = l.self().sum(), b = r.self().sum();
+    return a < b - SquareMat::EPS || std::fabs(a - b) < SquareMat::EPS;
+}
+template <class L, class R>
+bool operator> (const MatExpr<L>& l, const MatExpr<R>& r) {
+    return r < l;
+}
+template <class L, class R>
+bool operator>=(const MatExpr<L>& l, const MatExpr<R>& r) {
+    return r <= l;
+}
+
+// print an expression
+template <class E>
+std::ostream& operator<<(std::ostream& os, const MatExpr<E>& e) { return os << SquareMat(e.self()); }
+
 } // namespace MatrixLib
 #endif
@@ -0,0 +1,181 @@
+// eitan.derdiger@gmail.com
+
+#include "Strassen.h"
+#include "Gemm.h"
+#include "Alloc.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include <atomic>      // for the crossover switch
+#include <cmath>       // for pow, fabs
+#include <cfloat>      // for DBL_EPSILON
+#include <algorithm>   // for std::max
+#include <stdexcept>   // for invalid_argument
+
+using namespace MatrixLib;
+
+namespace {
+
+using detail::PAR_GRAIN;
+
+std::atomic<std::size_t> crossoverSetting{0};   // 0: disabled
+
+using BinaryKernel = void (*)(const double*, const double*, double*, std::size_t);
+
+// c = a op b on h x h strided blocks, one kernel call per row (c may alias a or b)
+void combine(BinaryKernel f, std::size_t h, const double* a, std::size_t la,
+             const double* b, std::size_t lb, double* c, std::size_t lc) {
+    ThreadPool::instance().parallelFor(h, PAR_GRAIN / h + 1, [&](std::size_t r0, std::size_t r1) {
+        for (std::size_t i = r0; i < r1; ++i)
+            f(a + i * la, b + i * lb, c + i * lc, h);
+    });
+}
+
+// doubles of workspace the recursion needs below order m
+std::size_t workspaceFor(std::size_t m, std::size_t cut) {
+    std::size_t total = 0;
+    for (; m > cut; m /= 2)
+        total += 2 * (m / 2) * (m / 2);
+    return total;
+}
+
+// Odd order m: the recursion produced the leading (m-1) x (m-1) block of A * B
+// from the leading blocks only. Add the rank-1 term of the peeled column/row
+// and compute the last row and column directly.
+void peel(std::size_t m, const double* A, std::size_t lda, const double* B, std::size_t ldb,
+          double* C, std::size_t ldc) {
+    std::size_t e = m - 1;
+    const double* bLast = B + e * ldb;   // last row of B
+    ThreadPool::instance().parallelFor(m, PAR_GRAIN / m + 1, [&](std::size_t r0, std::size_t r1) {
+        for (std::size_t i = r0; i < r1; ++i) {
+            const double* a = A + i * lda;
+            double* c = C + i * ldc;
+            if (i < e) {
+                double x = a[e];
+                for (std::size_t j = 0; j < e; ++j) c[j] += x * bLast[j];
+            } else {
+                // last row: a * B[:, 0..e), accumulated along rows of B
+                for (std::size_t j = 0; j < e; ++j) c[j] = a[0] * B[j];
+                for (std::size_t k = 1; k < m; ++k) {
+                    double x = a[k];
+                    const double* b = B + k * ldb;
+                    for (std::size_t j = 0; j < e; ++j) c[j] += x * b[j];
+                }
+            }
+            // last column: dot product with column e of B
+            double s = 0.0;
+            for (std::size_t k = 0; k < m; ++k) s += a[k] * B[k * ldb + e];
+            c[e] = s;
+        }
+    });
+}
+
+// One Winograd level with two h x h temporaries X and Y (Douglas et al.'s
+// schedule): the quadrants of C hold the other intermediate results.
+void winograd(std::size_t m, const double* A, std::size_t lda, const double* B, std::size_t ldb,
+              double* C, std::size_t ldc, double* ws, std::size_t cut) {
+    if (m <= cut) {
+        detail::gemm(m, m, m, 1.0, A, lda, false, B, ldb, false, 0.0, C, ldc);
+        return;
+    }
+    const detail::KernelTable& k = detail::kernels();
+    std::size_t h = m / 2;
+    const double *A11 = A, *A12 = A + h, *A21 = A + h * lda, *A22 = A21 + h;
+    const double *B11 = B, *B12 = B + h, *B21 = B + h * ldb, *B22 = B21 + h;
+    double *C11 = C, *C12 = C + h, *C21 = C + h * ldc, *C22 = C21 + h;
+    double* X = ws;
+    double* Y = ws + h * h;
+    double* next = Y + h * h;
+
+    combine(k.sub, h, A11, lda, A21, lda, X, h);          // S3 = A11 - A21
+    combine(k.sub, h, B22, ldb, B12, ldb, Y, h);          // T3 = B22 - B12
+    winograd(h, X, h, Y, h, C21, ldc, next, cut);         // P7 = S3 T3
+    combine(k.add, h, A21, lda, A22, lda, X, h);          // S1 = A21 + A22
+    combine(k.sub, h, B12, ldb, B11, ldb, Y, h);          // T1 = B12 - B11
+    winograd(h, X, h, Y, h, C22, ldc, next, cut);         // P5 = S1 T1
+    combine(k.sub, h, X, h, A11, lda, X, h);              // S2 = S1 - A11
+    combine(k.sub, h, B22, ldb, Y, h, Y, h);              // T2 = B22 - T1
+    winograd(h, X, h, Y, h, C12, ldc, next, cut);         // P6 = S2 T2
+    combine(k.sub, h, A12, lda, X, h, X, h);              // S4 = A12 - S2
+    winograd(h, X, h, B22, ldb, C11, ldc, next, cut);     // P3 = S4 B22
+    winograd(h, A11, lda, B11, ldb, X, h, next, cut);     // P1 = A11 B11
+    combine(k.add, h, X, h, C12, ldc, C12, ldc);          // U2 = P1 + P6
+    combine(k.add, h, C12, ldc, C21, ldc, C21, ldc);      // U3 = U2 + P7
+    combine(k.add, h, C12, ldc, C22, ldc, C12, ldc);      // U4 = U2 + P5
+    combine(k.add, h, C21, ldc, C22, ldc, C22, ldc);      // C22 = U3 + P5
+    combine(k.add, h, C12, ldc, C11, ldc, C12, ldc);      // C12 = U4 + P3
+    combine(k.sub, h, Y, h, B21, ldb, Y, h);              // T4 = T2 - B21
+    winograd(h, A22, lda, Y, h, C11, ldc, next, cut);     // P4 = A22 T4
+    combine(k.sub, h, C21, ldc, C11, ldc, C21, ldc);      // C21 = U3 - P4
+    winograd(h, A12, lda, B21, ldb, C11, ldc, next, cut); // P2 = A12 B21
+    combine(k.add, h, X, h, C11, ldc, C11, ldc);          // C11 = P1 + P2
+
+    if (m & 1) peel(m, A, lda, B, ldb, C, ldc);
+}
+
+// largest absolute element (from the one-pass summary)
+double maxAbs(const SquareMat& M) {
+    SquareMat::Summary s = M.summary();
+    return std::max(std::fabs(s.min), std::fabs(s.max));
+}
+
+} // namespace
+
+namespace MatrixLib {
+
+// ======= Configuration =======
+
+void setStrassen(bool enable, std::size_t crossover) {
+    if (enable && crossover < 2) throw std::invalid_argument("crossover");
+    crossoverSetting.store(enable ? crossover : 0);
+}
+
+namespace detail {
+
+std::size_t strassenCrossover() {
+    return crossoverSetting.load(std::memory_order_relaxed);
+}
+
+void strassenMultiply(std::size_t m, const double* A, std::size_t lda,
+                      const double* B, std::size_t ldb, double* C, std::size_t ldc,
+                      std::size_t crossover) {
+    std::size_t len = workspaceFor(m, crossover);
+    double* ws = allocDoubles(len);
+    try {
+        winograd(m, A, lda, B, ldb, C, ldc, ws, crossover);
+    } catch (...) {
+        freeDoubles(ws, len);
+        throw;
+    }
+    freeDoubles(ws, len);
+}
+
+} // namespace detail
+
+// ======= Products =======
+
+SquareMat strassen(const SquareMat& A, const SquareMat& B, StrassenReport* report) {
+    ensure_same(A, B);
+    std::size_t n = A.order();
+    std::size_t cut = detail::strassenCrossover();
+    if (cut == 0) cut = STRASSEN_CROSSOVER;
+
+    SquareMat C(n, SquareMat::Uninit{});   // every element is written below
+    if (n) detail::strassenMultiply(n, A.data(), n, B.data(), n, C.data(), n, cut);
+
+    if (report) {
+        unsigned levels = 0;
+        std::size_t leaf = n;
+        for (; leaf > cut; leaf /= 2) ++levels;
+        double u = DBL_EPSILON / 2;
+        double scale = n ? u * maxAbs(A) * maxAbs(B) : 0.0;
+        double n0 = static_cast<double>(leaf), p = std::pow(2.0, levels);
+        report->levels = levels;
+        report->leaf = leaf;
+        report->bound = (std::pow(18.0, levels) * (n0 * n0 + 6 * n0) - 6 * p * n0) * scale;
+        report->classicBound = static_cast<double>(n) * static_cast<double>(n) * scale;
+        if (levels == 0) report->bound = report->classicBound;
+    }
+    return C;
+}
+
+} // namespace MatrixLib
@@ -0,0 +1,58 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_STRASSEN_H
+#define MATRIXLIB_STRASSEN_H
+
+#include <cstddef>      // for size_t
+#include "SquareMat.h"
+
+namespace MatrixLib {
+
+// ===== Strassen-Winograd Multiply =====
+//
+// Recursive 2 x 2 block product with 7 sub-products and 15 additions
+// (Winograd's variant of Strassen). Orders at or below the crossover go to
+// the blocked GEMM engine; an odd order peels off its last row and column and
+// fixes them up with O(n^2) work. One workspace per product (about 2/3 n^2
+// doubles) holds the temporaries of every level.
+//
+// Fewer flops, weaker error bound: the error is bounded normwise rather than
+// per element, and the constant grows like 18^levels (see StrassenReport).
+// Off by default; setStrassen(true) makes operator*, *= and ^ use it for large
+// untransposed products.
+
+// Tuned crossover: leaves of 65 - 128 gave the best times from order 1024 up
+// (2048: 2.7 s vs 4.5 s for GEMM alone); below it GEMM wins
+constexpr std::size_t STRASSEN_CROSSOVER = 128;
+
+// First-order a-priori bounds on max |C - A*B| (u = unit roundoff):
+//   Winograd, k levels, leaf order n0:  (18^k (n0^2 + 6 n0) - 6 * 2^k n0) u max|A| max|B|
+//   classic product:                     n^2 u max|A| max|B|
+// (Higham, Accuracy and Stability of Numerical Algorithms, ch. 23)
+struct StrassenReport {
+    unsigned levels;        // recursion levels used (0: plain GEMM)
+    std::size_t leaf;       // order of the products handed to GEMM
+    double bound;           // bound for this product
+    double classicBound;    // bound for operator* on the same operands
+};
+
+// A * B by Strassen-Winograd (whatever setStrassen says); fills *report if given
+SquareMat strassen(const SquareMat& A, const SquareMat& B, StrassenReport* report = nullptr);
+
+// Route products of order > crossover through Strassen-Winograd (operator*,
+// *= and the squarings of ^). Transposed operands keep the classic path.
+void setStrassen(bool enable, std::size_t crossover = STRASSEN_CROSSOVER);
+
+namespace detail {
+
+// crossover in use, 0 when disabled
+std::size_t strassenCrossover();
+
+// C = A * B for m x m row-major buffers with row strides (C must not alias A or B)
+void strassenMultiply(std::size_t m, const double* A, std::size_t lda,
+                      const double* B, std::size_t ldb, double* C, std::size_t ldc,
+                      std::size_t crossover);
+
+} // namespace detail
+} // namespace MatrixLib
+#endif
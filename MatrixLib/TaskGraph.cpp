@@ -0,0 +1,173 @@
+// eitan.derdiger@gmail.com
+
+#include "TaskGraph.h"
+#include "ThreadPool.h"
+#include <algorithm>   // for std::copy, std::fill
+#include <exception>   // for exception_ptr
+#include <mutex>       // for mutex
+#include <stdexcept>   // for exceptions
+
+using namespace MatrixLib;
+
+namespace {
+constexpr std::size_t NONE = ~std::size_t(0);
+}
+
+// Ready tasks of one thread: the owner works at the back, thieves take from the front
+struct TaskGraph::Deque {
+    std::mutex m;
+    std::size_t* items = nullptr;
+    std::size_t front = 0;
+    std::size_t back = 0;
+
+    void push(std::size_t t) {
+        std::lock_guard<std::mutex> lk(m);
+        items[back++] = t;
+    }
+    std::size_t pop() {
+        std::lock_guard<std::mutex> lk(m);
+        return back > front ? items[--back] : NONE;
+    }
+    std::size_t steal() {
+        std::lock_guard<std::mutex> lk(m);
+        return back > front ? items[front++] : NONE;
+    }
+};
+
+// ======= Building =======
+
+TaskGraph::TaskGraph(std::size_t n)
+    : count(n), preds(new std::size_t[n]), left(new std::atomic<std::size_t>[n]),
+      head(new std::size_t[n]), edgeTo(nullptr), edgeNext(nullptr) {
+    std::fill(preds, preds + n, 0);
+    std::fill(head, head + n, NONE);
+}
+
+TaskGraph::~TaskGraph() {
+    delete[] preds;
+    delete[] left;
+    delete[] head;
+    delete[] edgeTo;
+    delete[] edgeNext;
+}
+
+void TaskGraph::depend(std::size_t before, std::size_t after) {
+    if (before >= count || after >= count) throw std::out_of_range("task");
+    if (edges == edgeCap) {  // grow both edge arrays
+        std::size_t cap = edgeCap ? 2 * edgeCap : 2 * count + 16;
+        std::size_t* to = new std::size_t[cap];
+        std::size_t* next = new std::size_t[cap];
+        std::copy(edgeTo, edgeTo + edges, to);
+        std::copy(edgeNext, edgeNext + edges, next);
+        delete[] edgeTo;
+        delete[] edgeNext;
+        edgeTo = to;
+        edgeNext = next;
+        edgeCap = cap;
+    }
+    edgeTo[edges] = after;
+    edgeNext[edges] = head[before];
+    head[before] = edges++;
+    ++preds[after];
+}
+
+// Kahn's algorithm: every task can be reached once its predecessors are done
+bool TaskGraph::acyclic() const {
+    std::size_t* deg = new std::size_t[count];
+    std::size_t* stack = new std::size_t[count];
+    std::size_t top = 0, seen = 0;
+    for (std::size_t t = 0; t < count; ++t) {
+        deg[t] = preds[t];
+        if (deg[t] == 0) stack[top++] = t;
+    }
+    while (top) {
+        std::size_t t = stack[--top];
+        ++seen;
+        for (std::size_t e = head[t]; e != NONE; e = edgeNext[e])
+            if (--deg[edgeTo[e]] == 0) stack[top++] = edgeTo[e];
+    }
+    delete[] deg;
+    delete[] stack;
+    return seen == count;
+}
+
+// ======= Execution =======
+
+void TaskGraph::execute(Trampoline fn, void* body) {
+    if (count == 0) return;
+    if (!acyclic()) throw std::logic_error("task graph has a cycle");
+    std::size_t workers = ThreadPool::instance().threads();
+
+    // every task is pushed exactly once, so each deque can hold all of them
+    Deque* deques = new Deque[workers];
+    for (std::size_t w = 0; w < workers; ++w)
+        deques[w].items = new std::size_t[count];
+
+    finished.store(0);
+    queued.store(0);
+    failed.store(false);
+    std::size_t next = 0;
+    for (std::size_t t = 0; t < count; ++t) {
+        left[t].store(preds[t]);
+        if (preds[t] == 0)
+            release(deques[next++ % workers], t);  // sources dealt round-robin
+    }
+
+    std::exception_ptr err;
+    try {
+        ThreadPool::instance().parallelFor(workers, 1, [&](std::size_t w0, std::size_t w1) {
+            for (std::size_t w = w0; w < w1; ++w)
+                workerLoop(w, workers, deques, fn, body);
+        });
+    } catch (...) {
+        err = std::current_exception();
+    }
+
+    for (std::size_t w = 0; w < workers; ++w)
+        delete[] deques[w].items;
+    delete[] deques;
+    if (err) std::rethrow_exception(err);
+}
+
+void TaskGraph::release(Deque& d, std::size_t task) {
+    queued.fetch_add(1);  // counted first, so a thief can never take it below zero
+    d.push(task);
+    wakeAll();
+}
+
+void TaskGraph::wakeAll() {
+    { std::lock_guard<std::mutex> lk(idleM); }  // a sleeper is either waiting or will see the change
+    idle.notify_all();
+}
+
+// Run tasks until all are finished. A thread that finds nothing to do sleeps;
+// work only appears when a running task completes.
+void TaskGraph::workerLoop(std::size_t id, std::size_t workers, Deque* deques,
+                           Trampoline fn, void* body) {
+    while (finished.load() < count && !failed.load()) {
+        std::size_t t = deques[id].pop();
+        for (std::size_t k = 1; t == NONE && k < workers; ++k)
+            t = deques[(id + k) % workers].steal();
+        if (t == NONE) {
+            std::unique_lock<std::mutex> lk(idleM);
+            idle.wait(lk, [&] {
+                return queued.load() > 0 || finished.load() == count || failed.load();
+            });
+            continue;
+        }
+        queued.fetch_sub(1);
+
+        try {
+            fn(body, t);
+        } catch (...) {
+            failed.store(true);
+            wakeAll();
+            throw;  // parallelFor hands it to the caller
+        }
+        for (std::size_t e = head[t]; e != NONE; e = edgeNext[e])
+            if (left[edgeTo[e]].fetch_sub(1) == 1)
+                release(deques[id], edgeTo[e]);
+        if (finished.fetch_add(1) + 1 == count)
+            wakeAll();
+    }
+}
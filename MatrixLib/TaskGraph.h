@@ -0,0 +1,79 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_TASKGRAPH_H
+#define MATRIXLIB_TASKGRAPH_H
+
+#include <cstddef>      // for size_t
+#include <atomic>       // for dependency counters
+#include <mutex>        // for mutex
+#include <condition_variable> // for idle threads
+#include <type_traits>  // for remove_reference
+
+namespace MatrixLib {
+
+// ===== Task Graph =====
+//
+// Tasks 0..count-1 with "after waits for before" edges, run on the ThreadPool.
+// Every thread owns a deque of ready tasks: it pops its own newest task (so a
+// task that was just unblocked runs next, on a warm cache) and steals the
+// oldest task from another deque when its own is empty; with nothing to
+// steal it sleeps until a task is released. Which thread runs a task never
+// changes what the task computes.
+class TaskGraph {
+public:
+    explicit TaskGraph(std::size_t count);
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+    ~TaskGraph();
+
+    // `after` may not start before `before` has finished
+    void depend(std::size_t before, std::size_t after);
+
+    // Run body(task) for every task, respecting the edges. The first exception
+    // thrown by a task stops the graph and is rethrown here; a cycle throws
+    // std::logic_error before anything runs.
+    template <class Body>
+    void run(Body&& body) {
+        using F = typename std::remove_reference<Body>::type;
+        execute(&invoke<F>, const_cast<void*>(static_cast<const void*>(&body)));
+    }
+
+    [[nodiscard]] std::size_t size() const { return count; }
+
+private:
+    using Trampoline = void (*)(void*, std::size_t);
+
+    template <class Body>
+    static void invoke(void* body, std::size_t task) {
+        (*static_cast<Body*>(body))(task);
+    }
+
+    struct Deque;
+
+    void execute(Trampoline fn, void* body);
+    void workerLoop(std::size_t id, std::size_t workers, Deque* deques, Trampoline fn, void* body);
+    void release(Deque& d, std::size_t task);   // push a ready task and wake a sleeper
+    void wakeAll();
+    bool acyclic() const;
+
+    std::size_t count;
+    std::size_t* preds;              // number of predecessors of each task
+    std::atomic<std::size_t>* left;  // predecessors still running (during run)
+
+    // successor lists as linked edges: head[t] -> edge -> next ... (raw arrays)
+    std::size_t* head;
+    std::size_t* edgeTo;
+    std::size_t* edgeNext;
+    std::size_t edges = 0;
+    std::size_t edgeCap = 0;
+
+    std::atomic<std::size_t> finished{0};
+    std::atomic<std::size_t> queued{0};   // tasks sitting in some deque
+    std::atomic<bool> failed{false};
+    std::mutex idleM;
+    std::condition_variable idle;
+};
+
+} // namespace MatrixLib
+#endif
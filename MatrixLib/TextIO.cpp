@@ -0,0 +1,309 @@
+// eitan.derdiger@gmail.com
+
+#include "SquareMat.h"
+#include "Alloc.h"
+#include "ThreadPool.h"
+#include <charconv>    // for to_chars, from_chars
+#include <algorithm>   // for std::copy
+#include <cstring>     // for memcpy
+#include <cstdio>      // for EOF
+#include <string>      // for error messages
+#include <stdexcept>   // for invalid_argument
+
+using namespace MatrixLib;
+
+namespace {
+
+// longest shortest-round-trip double: "-2.2250738585072014e-308"
+constexpr std::size_t MAX_NUMBER = 24;
+
+// room for one element with its surroundings: "[ " + number + " ]\n"
+constexpr std::size_t ELEM_ROOM = 32;
+
+// stack buffer operator<< formats into before each write to the stream
+constexpr std::size_t TEXT_BUFFER = std::size_t(16) << 10;
+
+// text built per pass for large matrices (rows formatted in parallel)
+constexpr std::size_t FORMAT_SCRATCH = std::size_t(4) << 20;
+
+using detail::PAR_GRAIN;
+
+// ======= Formatting =======
+
+// Element j of a row of n, with the text before and after it ("[ " for the
+// first, ", " between, " ]\n" after the last); p has ELEM_ROOM characters
+inline char* putElement(char* p, double v, std::size_t j, std::size_t n) {
+    if (j == 0) { p[0] = '['; p[1] = ' '; }
+    else        { p[0] = ','; p[1] = ' '; }
+    p = std::to_chars(p + 2, p + 2 + MAX_NUMBER, v).ptr;
+    if (j + 1 == n) {
+        std::memcpy(p, " ]\n", 3);
+        p += 3;
+    }
+    return p;
+}
+
+// Large matrices: rows are formatted in parallel into one slot each (a row
+// never exceeds its bound), a pass of rows at a time, and handed to emit(text,
+// len) in row order; emit returns false to stop
+template <class Emit>
+void formatRows(const double* elems, std::size_t n, Emit&& emit) {
+    std::size_t rowBound = n * (MAX_NUMBER + 2) + 3;
+    std::size_t group = std::min(n, std::max<std::size_t>(1, FORMAT_SCRATCH / rowBound));
+    char* scratch = new char[group * rowBound];
+    std::size_t* len = new std::size_t[group];
+    try {
+        for (std::size_t r0 = 0; r0 < n; r0 += group) {
+            std::size_t rows = std::min(group, n - r0);
+            ThreadPool::instance().parallelFor(rows, PAR_GRAIN / n + 1, [&](std::size_t k0, std::size_t k1) {
+                for (std::size_t k = k0; k < k1; ++k) {
+                    const double* row = elems + (r0 + k) * n;
+                    char* start = scratch + k * rowBound;
+                    char* p = start;
+                    for (std::size_t j = 0; j < n; ++j)
+                        p = putElement(p, row[j], j, n);
+                    len[k] = static_cast<std::size_t>(p - start);
+                }
+            });
+            bool more = true;
+            for (std::size_t k = 0; k < rows && more; ++k)
+                more = emit(scratch + k * rowBound, len[k]);
+            if (!more) break;
+        }
+    } catch (...) {
+        delete[] scratch;
+        delete[] len;
+        throw;
+    }
+    delete[] scratch;
+    delete[] len;
+}
+
+// ======= Parsing =======
+//
+// The reader runs on one of two sources: a string_view, where numbers are
+// converted in place, or a streambuf, where a number's characters are
+// gathered first. Both count characters for error messages.
+
+[[noreturn]] void fail(std::size_t offset, const char* what) {
+    throw std::invalid_argument("parse error at offset " + std::to_string(offset) + ": " + what);
+}
+
+inline bool isSpace(int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+// characters a number can contain (digits, sign, point, exponent, inf, nan)
+inline bool isNumberChar(int c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '.' || c == '-' || c == '+';
+}
+
+struct ViewSource {
+    const char* begin;
+    const char* p;
+    const char* end;
+
+    int peek() const { return p < end ? static_cast<unsigned char>(*p) : EOF; }
+    void bump() { ++p; }
+    std::size_t offset() const { return static_cast<std::size_t>(p - begin); }
+
+    bool number(double& v) {
+        if (p < end && *p == '+') ++p;   // from_chars takes no leading '+'
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec != std::errc()) return false;
+        p = r.ptr;
+        return true;
+    }
+};
+
+struct StreamSource {
+    std::streambuf* sb;
+    std::size_t count = 0;
+
+    int peek() { return sb->sgetc(); }
+    void bump() { sb->sbumpc(); ++count; }
+    std::size_t offset() const { return count; }
+
+    bool number(double& v) {
+        char tok[64];
+        std::size_t len = 0;
+        for (int c = sb->sgetc(); c != EOF && isNumberChar(c); c = sb->snextc()) {
+            if (len == sizeof tok) return false;
+            tok[len++] = static_cast<char>(c);
+        }
+        count += len;
+        const char* first = tok;
+        if (len && *first == '+') ++first;
+        std::from_chars_result r = std::from_chars(first, tok + len, v);
+        return r.ec == std::errc() && r.ptr == tok + len;
+    }
+};
+
+template <class Src>
+void skipSpace(Src& s) {
+    while (isSpace(s.peek())) s.bump();
+}
+
+template <class Src>
+void expect(Src& s, char c, const char* what) {
+    skipSpace(s);
+    if (s.peek() != static_cast<unsigned char>(c)) fail(s.offset(), what);
+    s.bump();
+}
+
+template <class Src>
+double readNumber(Src& s) {
+    skipSpace(s);
+    double v;
+    if (!s.number(v)) fail(s.offset(), "expected a number");
+    return v;
+}
+
+// growable buffer for the first row, whose length is the order
+struct RowBuffer {
+    double* p = nullptr;
+    std::size_t len = 0, cap = 0;
+
+    ~RowBuffer() { detail::freeDoubles(p, cap); }
+    void push(double v) {
+        if (len == cap) {
+            std::size_t grown = cap ? cap * 2 : 64;
+            double* q = detail::allocDoubles(grown);
+            std::copy(p, p + len, q);
+            detail::freeDoubles(p, cap);
+            p = q;
+            cap = grown;
+        }
+        p[len++] = v;
+    }
+};
+
+// Read "[ a, b ]" rows, the first one fixing the order (the source must be at
+// a '[' after optional whitespace)
+template <class Src>
+SquareMat readMatrix(Src& s) {
+    RowBuffer first;
+    expect(s, '[', "expected '['");
+    for (;;) {
+        first.push(readNumber(s));
+        skipSpace(s);
+        if (s.peek() == ']') break;
+        expect(s, ',', "expected ',' or ']'");
+    }
+    s.bump();
+
+    std::size_t n = first.len;
+    SquareMat M(n);
+    double* out = M.data();
+    std::copy(first.p, first.p + n, out);
+    for (std::size_t i = 1; i < n; ++i) {
+        expect(s, '[', "expected '[' (too few rows?)");
+        double* row = out + i * n;
+        for (std::size_t j = 0; j < n; ++j) {
+            row[j] = readNumber(s);
+            if (j + 1 < n) expect(s, ',', "expected ',' (row shorter than the first)");
+        }
+        expect(s, ']', "expected ']' (row longer than the first)");
+    }
+    return M;
+}
+
+} // namespace
+
+namespace MatrixLib {
+
+// ======= Text Output =======
+
+std::ostream& detail::writeText(std::ostream& os, const double* elems, std::size_t n) {
+    if (n * n >= PAR_GRAIN) {
+        formatRows(elems, n, [&](const char* text, std::size_t len) {
+            os.write(text, static_cast<std::streamsize>(len));
+            return true;
+        });
+        return os;
+    }
+    char buf[TEXT_BUFFER];
+    char* p = buf;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            if (static_cast<std::size_t>(buf + TEXT_BUFFER - p) < ELEM_ROOM) {
+                os.write(buf, p - buf);
+                p = buf;
+            }
+            p = putElement(p, elems[i * n + j], j, n);
+        }
+    return os.write(buf, p - buf);
+}
+
+// Print matrix nicely
+std::ostream& operator<<(std::ostream& os, const SquareMat& M) {
+    return detail::writeText(os, M.elems, M.n);
+}
+
+// Same as <<
+std::ostream& operator>>(std::ostream& os, const SquareMat& M) {
+    return operator<<(os, M);
+}
+
+std::size_t SquareMat::textBound() const {
+    // per row "[ " and " ]\n", n numbers and n - 1 separators
+    return n * (n * (MAX_NUMBER + 2) + 3);
+}
+
+std::to_chars_result SquareMat::format(char* first, char* last) const {
+    char* p = first;
+    if (n * n >= PAR_GRAIN) {
+        bool fits = true;
+        formatRows(elems, n, [&](const char* text, std::size_t len) {
+            fits = static_cast<std::size_t>(last - p) >= len;
+            if (fits) {
+                std::memcpy(p, text, len);
+                p += len;
+            }
+            return fits;
+        });
+        if (!fits) return {last, std::errc::value_too_large};
+        return {p, std::errc()};
+    }
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            double v = elems[i * n + j];
+            if (static_cast<std::size_t>(last - p) >= ELEM_ROOM) {
+                p = putElement(p, v, j, n);
+                continue;
+            }
+            // near the end: format aside and copy only if it fits
+            char tmp[ELEM_ROOM];
+            std::size_t len = static_cast<std::size_t>(putElement(tmp, v, j, n) - tmp);
+            if (static_cast<std::size_t>(last - p) < len) return {last, std::errc::value_too_large};
+            std::memcpy(p, tmp, len);
+            p += len;
+        }
+    return {p, std::errc()};
+}
+
+// ======= Text Input =======
+
+SquareMat SquareMat::parse(std::string_view text) {
+    ViewSource s{text.data(), text.data(), text.data() + text.size()};
+    skipSpace(s);
+    if (s.peek() == EOF) return SquareMat();
+    SquareMat M = readMatrix(s);
+    skipSpace(s);
+    if (s.peek() != EOF) fail(s.offset(), "trailing characters");
+    return M;
+}
+
+// Reads through the streambuf directly, stopping right after the last ']'
+std::istream& operator>>(std::istream& is, SquareMat& M) {
+    std::istream::sentry ok(is);   // skips leading whitespace
+    if (!ok) return is;
+    StreamSource s{is.rdbuf()};
+    try {
+        M = readMatrix(s);
+    } catch (const std::invalid_argument&) {
+        is.setstate(s.peek() == EOF ? std::ios::failbit | std::ios::eofbit : std::ios::failbit);
+    }
+    return is;
+}
+
+} // namespace MatrixLib
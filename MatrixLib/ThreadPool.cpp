@@ -0,0 +1,162 @@
+// eitan.derdiger@gmail.com
+
+#include "ThreadPool.h"
+#include <cstdlib>     // for getenv, strtoul
+
+#ifdef __linux__
+#include <pthread.h>   // for pthread_setaffinity_np
+#include <sched.h>     // for cpu_set_t
+#endif
+
+using namespace MatrixLib;
+
+thread_local bool ThreadPool::inWorker = false;
+
+// ======= Lifetime =======
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::configure(std::size_t threads, bool pinToCores) {
+    ThreadPool& p = instance();
+    std::lock_guard<std::mutex> guard(p.submit); // no job may be running
+    p.stop();
+    std::lock_guard<std::mutex> lk(p.m);
+    p.wanted = threads;
+    p.pin = pinToCores;
+}
+
+std::size_t ThreadPool::threads() {
+    std::lock_guard<std::mutex> lk(m);
+    if (!started) start();
+    return nWorkers + 1;
+}
+
+// Spawn the workers (called with m held)
+void ThreadPool::start() {
+    std::size_t total = wanted;
+    if (total == 0) {
+        if (const char* env = std::getenv("MATRIXLIB_THREADS"))
+            total = std::strtoul(env, nullptr, 10);
+    }
+    if (total == 0) total = std::thread::hardware_concurrency();
+    if (total == 0) total = 1;
+
+    stopping = false;
+    nWorkers = total - 1;
+    workers = nWorkers ? new std::thread[nWorkers] : nullptr;
+    for (std::size_t i = 0; i < nWorkers; ++i)
+        workers[i] = std::thread(&ThreadPool::workerLoop, this, i);
+    started = true;
+}
+
+// Join all workers; the next parallel call starts a fresh set
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        if (!started) return;
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::size_t i = 0; i < nWorkers; ++i)
+        workers[i].join();
+    delete[] workers;
+    workers = nullptr;
+    nWorkers = 0;
+    started = false;
+}
+
+// ======= Workers =======
+
+void ThreadPool::workerLoop(std::size_t id) {
+    inWorker = true;
+#ifdef __linux__
+    if (pin) {
+        unsigned cores = std::thread::hardware_concurrency();
+        if (cores) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((id + 1) % cores, &set);  // core 0 is left to the caller
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+    }
+#else
+    (void)id;
+#endif
+
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lk(m);
+    for (;;) {
+        wake.wait(lk, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        ++busy;
+        lk.unlock();
+        runChunks();
+        lk.lock();
+        --busy;
+        done.notify_all();
+    }
+}
+
+// Grab chunks of the current job until none are left
+void ThreadPool::runChunks() {
+    for (;;) {
+        std::size_t c = nextChunk.fetch_add(1);
+        if (c >= jobChunks) return;
+        std::size_t begin = c * jobGrain;
+        std::size_t end = begin + jobGrain < jobCount ? begin + jobGrain : jobCount;
+        try {
+            jobFn(jobBody, begin, end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lk(m);
+            if (!jobError) jobError = std::current_exception();
+        }
+        doneChunks.fetch_add(1);
+    }
+}
+
+// ======= Job Submission =======
+
+void ThreadPool::run(std::size_t count, std::size_t grain, Trampoline fn, void* body) {
+    std::unique_lock<std::mutex> sub(submit, std::try_to_lock);
+    if (!sub.owns_lock()) {  // pool busy with another caller's job
+        fn(body, 0, count);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lk(m);
+        // a late worker may still be leaving the previous job
+        done.wait(lk, [&] { return busy == 0; });
+        jobFn = fn;
+        jobBody = body;
+        jobCount = count;
+        jobGrain = grain;
+        jobChunks = (count + grain - 1) / grain;
+        jobError = nullptr;
+        nextChunk.store(0);
+        doneChunks.store(0);
+        ++generation;
+    }
+    wake.notify_all();
+
+    // the caller works too
+    inWorker = true;
+    runChunks();
+    inWorker = false;
+
+    std::exception_ptr err;
+    {
+        std::unique_lock<std::mutex> lk(m);
+        done.wait(lk, [&] { return doneChunks.load() == jobChunks; });
+        err = jobError;
+    }
+    if (err) std::rethrow_exception(err);
+}
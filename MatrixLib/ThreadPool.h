@@ -0,0 +1,96 @@
+// eitan.derdiger@gmail.com
+
+#ifndef MATRIXLIB_THREADPOOL_H
+#define MATRIXLIB_THREADPOOL_H
+
+#include <cstddef>              // for size_t
+#include <atomic>               // for atomic counters
+#include <mutex>                // for mutex
+#include <condition_variable>   // for condition_variable
+#include <exception>            // for exception_ptr
+#include <thread>               // for thread
+#include <type_traits>          // for remove_reference
+
+namespace MatrixLib {
+
+// ===== Thread Pool =====
+//
+// Process-wide pool used by the heavy SquareMat operations. Workers are started
+// lazily on the first parallel call. Work is always split into the same
+// fixed-size chunks, so results never depend on how many threads ran them.
+// Calls made from inside a worker (nested parallelism) run inline.
+class ThreadPool {
+public:
+    // the shared pool (not started until first use)
+    static ThreadPool& instance();
+
+    // Set the total number of threads (caller included) and optional core pinning.
+    // 0 means one per hardware thread, or $MATRIXLIB_THREADS if set.
+    // Running workers are stopped; new ones start on the next parallel call.
+    static void configure(std::size_t threads, bool pinToCores = false);
+
+    // total threads that take part in a parallel call (workers + caller)
+    std::size_t threads();
+
+    // Run body(begin, end) over [0, count) in chunks of at most `grain` indices.
+    // Runs inline when there is only one chunk, one thread, or we are nested.
+    template <class Body>
+    void parallelFor(std::size_t count, std::size_t grain, Body&& body) {
+        if (grain == 0) grain = 1;
+        if (count <= grain || inWorker || threads() == 1) {
+            if (count) body(std::size_t(0), count);
+            return;
+        }
+        using F = typename std::remove_reference<Body>::type;
+        run(count, grain, &invoke<F>, const_cast<void*>(static_cast<const void*>(&body)));
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+private:
+    using Trampoline = void (*)(void*, std::size_t, std::size_t);
+
+    template <class Body>
+    static void invoke(void* body, std::size_t begin, std::size_t end) {
+        (*static_cast<Body*>(body))(begin, end);
+    }
+
+    ThreadPool() = default;
+
+    void start();                   // spawn workers (lock held)
+    void stop();                    // join workers
+    void workerLoop(std::size_t id);
+    void runChunks();               // execute chunks of the current job
+    void run(std::size_t count, std::size_t grain, Trampoline fn, void* body);
+
+    // current job (one at a time; a second concurrent caller runs inline)
+    Trampoline jobFn = nullptr;
+    void* jobBody = nullptr;
+    std::size_t jobCount = 0;
+    std::size_t jobGrain = 0;
+    std::size_t jobChunks = 0;
+    std::atomic<std::size_t> nextChunk{0};
+    std::atomic<std::size_t> doneChunks{0};
+    std::exception_ptr jobError;
+
+    std::mutex m;
+    std::mutex submit;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned long generation = 0;
+    std::size_t busy = 0;           // workers currently inside a job
+    bool stopping = false;
+
+    std::thread* workers = nullptr;
+    std::size_t nWorkers = 0;
+    std::size_t wanted = 0;         // configured total threads (0 = auto)
+    bool pin = false;
+    bool started = false;
+
+    static thread_local bool inWorker;
+};
+
+} // namespace MatrixLib
+#endif
@@ -3,10 +3,47 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "../MatrixLib/SquareMat.h"
+#include "../MatrixLib/Kernels.h"
+#include "../MatrixLib/Gemm.h"
+#include "../MatrixLib/ThreadPool.h"
+#include "../MatrixLib/LU.h"
+#include "../MatrixLib/TaskGraph.h"
+#include "../MatrixLib/Alloc.h"
+#include "../MatrixLib/FixedSquareMat.h"
+#include "../MatrixLib/Strassen.h"
+#include "../MatrixLib/Batch.h"
+#include "../MatrixLib/OutOfCore.h"
 #include <sstream>
+#include <cstdlib>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 using MatrixLib::SquareMat;
 
+// Count matrix buffers an expression asks for (pool hits included)
+static std::size_t matrixAllocs() {
+    return MatrixLib::poolStats().requests;
+}
+
+// Count blocks that reach the allocator hook (pool misses and big buffers)
+static std::size_t g_hookAllocs = 0;
+
+static void* countingAllocate(std::size_t bytes, std::size_t align, void*) {
+    ++g_hookAllocs;
+    MatrixLib::Allocator base = MatrixLib::defaultAllocator();
+    return base.allocate(bytes, align, base.ctx);
+}
+static void countingDeallocate(void* p, std::size_t bytes, void*) {
+    MatrixLib::Allocator base = MatrixLib::defaultAllocator();
+    base.deallocate(p, bytes, base.ctx);
+}
+static const bool g_countingInstalled =
+    (MatrixLib::setAllocator({countingAllocate, countingDeallocate, nullptr}), true);
+
 // Test constructors and element access
 TEST_CASE("constructors & access") {
     SquareMat Z;  // default constructor
@@ -21,8 +58,10 @@ TEST_CASE("constructors & access") {
     // Invalid: not square
     CHECK_THROWS_AS((SquareMat(std::initializer_list<std::initializer_list<double>>{{1,2,3}})), std::invalid_argument);
 
-    // Invalid access
+    // Invalid access (checked builds only)
+#if MATRIXLIB_BOUNDS_CHECK
     CHECK_THROWS_AS((void)B[5][0], std::out_of_range);
+#endif
 }
 
 // Test basic arithmetic and unary minus
@@ -185,3 +224,1248 @@ TEST_CASE("ensure_same") {
     // Test invalid operation (different size matrices)
     CHECK_THROWS_AS(A + C, std::invalid_argument);  // Should throw exception due to size mismatch
 }
+
+// Test blocked GEMM path against a naive reference (odd orders hit the edge tiles)
+TEST_CASE("large matrix multiply (blocked GEMM)") {
+    for (std::size_t n : {64u, 67u, 131u, 300u}) {
+        SquareMat A(n), B(n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j) {
+                A[i][j] = static_cast<double>((i * 7 + j * 3) % 11) - 5.0;
+                B[i][j] = static_cast<double>((i * 5 + j * 13) % 17) - 8.0;
+            }
+
+        SquareMat C = A * B;
+        bool ok = true;
+        for (std::size_t i = 0; i < n && ok; ++i)
+            for (std::size_t j = 0; j < n && ok; ++j) {
+                double ref = 0;
+                for (std::size_t k = 0; k < n; ++k)
+                    ref += A[i][k] * B[k][j];
+                ok = (C[i][j] == ref);  // small integers: exact in double
+            }
+        CHECK(ok);
+
+        SquareMat D = A;
+        D *= B;
+        CHECK(D.sum() == doctest::Approx(C.sum()));
+    }
+
+    // the microkernel the CPU gets rounds exactly like the portable order:
+    // per KC block, sum the products in k order, then add the block to C
+    const std::size_t M = 70, N = 75, K = 300;
+    double* a = new double[M * K];
+    double* b = new double[K * N];
+    double* c = new double[M * N];
+    for (std::size_t k = 0; k < M * K; ++k) a[k] = std::sin(static_cast<double>(k));
+    for (std::size_t k = 0; k < K * N; ++k) b[k] = std::cos(static_cast<double>(k) * 0.7);
+    MatrixLib::detail::gemm(M, N, K, 1.0, a, K, false, b, N, false, 0.0, c, N);
+    bool same = true;
+    for (std::size_t i = 0; i < M; ++i)
+        for (std::size_t j = 0; j < N; ++j) {
+            double ref = 0;
+            for (std::size_t p0 = 0; p0 < K; p0 += MatrixLib::detail::GEMM_KC) {
+                double acc = 0;
+                for (std::size_t p = p0; p < std::min(K, p0 + MatrixLib::detail::GEMM_KC); ++p)
+                    acc += a[i * K + p] * b[p * N + j];
+                ref += 1.0 * acc;
+            }
+            same = same && c[i * N + j] == ref;
+        }
+    CHECK(same);
+    delete[] a;
+    delete[] b;
+    delete[] c;
+}
+
+// Test that every SIMD table the host supports gives the same bits
+TEST_CASE("SIMD kernel tables agree") {
+    using namespace MatrixLib::detail;
+    const std::size_t len = 67;  // not a multiple of any vector width
+    double a[len], b[len];
+    for (std::size_t i = 0; i < len; ++i) {
+        a[i] = 0.1 * static_cast<double>(i) - 3.0;
+        b[i] = 1.0 / static_cast<double>(i + 1);
+    }
+
+    const KernelTable& base = kernelTable(Isa::SSE2);
+    for (Isa isa : {Isa::AVX2, Isa::AVX512}) {
+        if (!isaSupported(isa)) continue;
+        const KernelTable& k = kernelTable(isa);
+        double r1[len], r2[len];
+        bool same = true;
+
+        base.add(a, b, r1, len);    k.add(a, b, r2, len);
+        for (std::size_t i = 0; i < len; ++i) same = same && r1[i] == r2[i];
+        base.mul(a, b, r1, len);    k.mul(a, b, r2, len);
+        for (std::size_t i = 0; i < len; ++i) same = same && r1[i] == r2[i];
+        base.div(a, 3.0, r1, len);  k.div(a, 3.0, r2, len);
+        for (std::size_t i = 0; i < len; ++i) same = same && r1[i] == r2[i];
+        base.neg(a, r1, len);       k.neg(a, r2, len);
+        for (std::size_t i = 0; i < len; ++i) same = same && r1[i] == r2[i];
+
+        CHECK(same);
+        CHECK(base.sum(b, len) == k.sum(b, len));
+    }
+
+    // the selected table handles aliasing (out == in) like ++ does
+    SquareMat M(5, 1.5);
+    ++M;
+    CHECK(M[4][4] == 2.5);
+    CHECK(M.sum() == doctest::Approx(62.5));
+}
+
+// Test that threaded results match single-threaded ones bit for bit
+TEST_CASE("thread pool results are deterministic") {
+    using MatrixLib::ThreadPool;
+    const std::size_t n = 300;
+    SquareMat A(n), B(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            A[i][j] = std::sin(static_cast<double>(i * n + j));
+            B[i][j] = std::cos(static_cast<double>(i + 2 * j));
+        }
+
+    ThreadPool::configure(1);
+    SquareMat P1 = A * B, T1 = ~A, S1 = A + B;
+    double sum1 = A.sum(), det1 = !A;
+
+    ThreadPool::configure(4);
+    CHECK(ThreadPool::instance().threads() == 4);
+    SquareMat P4 = A * B, T4 = ~A, S4 = A + B;
+    double sum4 = A.sum(), det4 = !A;
+
+    bool same = true;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            same = same && P1[i][j] == P4[i][j] && T1[i][j] == T4[i][j] && S1[i][j] == S4[i][j];
+    CHECK(same);
+    CHECK(sum1 == sum4);
+    CHECK(det1 == det4);
+
+    ThreadPool::configure(0);  // back to the default
+}
+
+// Test move semantics: temporaries hand their buffers on instead of copying
+TEST_CASE("move semantics reuse buffers") {
+    SquareMat A(8, 1.0), B(8, 2.0), C(8, 4.0);
+
+    std::size_t before = matrixAllocs();
+    SquareMat D = A + B - C;               // one buffer, reused by the subtraction
+    CHECK(matrixAllocs() - before == 1);
+    CHECK(D[3][3] == -1.0);
+
+    before = matrixAllocs();
+    D = 2 * (A + B) % C / 4.0 + A;         // evaluated straight into D's buffer
+    CHECK(matrixAllocs() - before == 0);
+    CHECK(D[0][0] == 7.0);
+
+    before = matrixAllocs();
+    SquareMat E = std::move(D);            // move construction allocates nothing
+    D = std::move(E);                      // neither does move assignment
+    CHECK(matrixAllocs() - before == 0);
+    CHECK(D[7][7] == 7.0);
+    CHECK(E.order() == 0);
+
+}
+
+// Test that compound assignments work in place without allocating
+TEST_CASE("in-place compound assignments") {
+    SquareMat A(8, 3.0), B(8, 2.0);
+    SquareMat I(8);
+    for (std::size_t i = 0; i < 8; ++i) I[i][i] = 1.0;
+
+    A *= I;  // warm up the multiply workspace for this order
+
+    std::size_t before = matrixAllocs();
+    A += B;  A -= B;  A %= B;  A /= 2.0;  A %= 2;
+    A *= I;  A *= I;  A *= I;
+    CHECK(matrixAllocs() - before == 0);
+    CHECK(A[5][2] == 1.0);   // ((3 + 2 - 2) * 2 / 2) mod 2
+
+    A *= A;                  // aliasing operands is fine
+    CHECK(A[0][0] == 8.0);
+
+    SquareMat C(3);
+    CHECK_THROWS_AS(A += C, std::invalid_argument);
+    CHECK_THROWS_AS(A *= C, std::invalid_argument);
+    CHECK_THROWS_AS(A /= 0.0, std::invalid_argument);
+    CHECK_THROWS_AS(A %= 0, std::invalid_argument);
+}
+
+// Test lazy expression evaluation
+TEST_CASE("expression templates") {
+    SquareMat A{{1, 2}, {3, 4}};
+    SquareMat B{{5, 6}, {7, 8}};
+    SquareMat C{{2, 2}, {2, 2}};
+
+    // nothing is allocated until the expression is assigned
+    std::size_t before = matrixAllocs();
+    auto expr = A + B % C - 2 * A;
+    CHECK(matrixAllocs() - before == 0);
+    CHECK(expr[1][1] == 12.0);             // 4 + 8*2 - 8, evaluated on access
+    SquareMat D = expr;
+    CHECK(matrixAllocs() - before == (SquareMat::INLINE_ORDER >= 2 ? 0 : 1));  // 2 x 2 fits inline
+    CHECK(D[0][1] == 10.0);                // 2 + 6*2 - 4
+
+    // the destination may appear inside the expression
+    D = D + D % D - D / 2;
+    CHECK(D[0][1] == 105.0);               // 10 + 100 - 5
+
+    // fused += on an expression, negation, and results used like matrices
+    A += B - C;
+    CHECK(A[1][0] == 8.0);
+    CHECK((-A)[0][0] == -4.0);
+    CHECK((A + B).sum() == doctest::Approx(54.0));
+    CHECK((A - A) == SquareMat(2));
+    CHECK(((A + B) * C)[0][0] == doctest::Approx(2 * (9 + 12)));
+
+    // order checks happen when the node is built
+    SquareMat E(3);
+    CHECK_THROWS_AS(A + B % E, std::invalid_argument);
+    CHECK_THROWS_AS(A / 0.0, std::invalid_argument);
+}
+
+// Test transposed products run on the original buffers and match explicit transposes
+TEST_CASE("fused transpose multiply") {
+    for (std::size_t n : {5u, 100u}) {
+        SquareMat A(n), B(n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j) {
+                A[i][j] = std::sin(static_cast<double>(3 * i + j));
+                B[i][j] = std::cos(static_cast<double>(i * j + 1));
+            }
+        SquareMat At = ~A, Bt = ~B;
+
+        SquareMat P1 = ~A * B, P2 = A * ~B, P3 = ~A * ~B, P4 = multiply(A, B, true, false);
+        SquareMat R1 = At * B, R2 = A * Bt, R3 = At * Bt;
+        bool same = true;
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                same = same && P1[i][j] == R1[i][j] && P2[i][j] == R2[i][j]
+                            && P3[i][j] == R3[i][j] && P4[i][j] == R1[i][j];
+        CHECK(same);
+    }
+
+    SquareMat A{{1, 2}, {3, 4}};
+    SquareMat B{{0, 1}, {1, 0}};
+    std::size_t before = matrixAllocs();
+    SquareMat P = ~A * B;                  // only the result needs storage
+    CHECK(matrixAllocs() - before == (SquareMat::INLINE_ORDER >= 2 ? 0 : 1));
+    CHECK(P[0][0] == 3);
+
+    A = ~A + B;                            // reads itself transposed: still correct
+    CHECK(A[0][1] == 4);
+    CHECK(A[1][0] == 3);
+    A = ~A;
+    CHECK(A[0][1] == 3);
+}
+
+// Test blocked and in-place transposes against the definition (odd orders hit every edge case)
+TEST_CASE("blocked and in-place transpose") {
+    using namespace MatrixLib::detail;
+    for (std::size_t n : {1u, 7u, 33u, 100u, 257u}) {
+        SquareMat A(n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                A[i][j] = static_cast<double>(i * 1000 + j);
+
+        SquareMat T = ~A;
+        SquareMat B = A;
+        std::size_t before = matrixAllocs();
+        B.transposeInPlace();
+        CHECK(matrixAllocs() - before == 0);
+
+        bool ok = true;
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                ok = ok && T[j][i] == A[i][j] && B[j][i] == A[i][j];
+        CHECK(ok);
+    }
+
+    // every SIMD table's tile kernel agrees with the definition
+    const std::size_t r = 19, c = 13;
+    double src[r * c], dst[c * r];
+    for (std::size_t i = 0; i < r * c; ++i) src[i] = static_cast<double>(i);
+    for (Isa isa : {Isa::SSE2, Isa::AVX2, Isa::AVX512}) {
+        if (!isaSupported(isa)) continue;
+        kernelTable(isa).transpose(src, c, dst, r, r, c);
+        bool ok = true;
+        for (std::size_t i = 0; i < r; ++i)
+            for (std::size_t j = 0; j < c; ++j)
+                ok = ok && dst[j * r + i] == src[i * c + j];
+        CHECK(ok);
+    }
+}
+
+// Test iterative power: agrees with repeated products, reuses buffers, short-circuits special inputs
+TEST_CASE("power by squaring") {
+    SquareMat A{{0.5, 0.25, 0.25}, {0.1, 0.8, 0.1}, {0.3, 0.3, 0.4}};  // Markov transition matrix
+    SquareMat R = A;
+    for (int i = 1; i < 13; ++i) R = R * A;
+    SquareMat P = A ^ 13;
+    bool close = true;
+    for (std::size_t i = 0; i < 3; ++i)
+        for (std::size_t j = 0; j < 3; ++j)
+            close = close && std::fabs(P[i][j] - R[i][j]) < 1e-12;
+    CHECK(close);
+
+    std::size_t before = matrixAllocs();
+    SquareMat Q = A ^ 1000000;               // fixed set of buffers, whatever k is
+    CHECK(matrixAllocs() - before <= 3);
+    CHECK(Q[0][0] + Q[0][1] + Q[0][2] == doctest::Approx(1.0));   // rows stay stochastic
+
+    SquareMat Proj{{1, 1}, {0, 0}};          // idempotent: Proj^2 == Proj
+    CHECK((Proj ^ 4000000000u)[0][1] == 1);
+
+    SquareMat D{{2, 0, 0}, {0, -1, 0}, {0, 0, 0.5}};
+    SquareMat Dk = D ^ 11;
+    CHECK(Dk[0][0] == 2048);
+    CHECK(Dk[1][1] == -1);
+    CHECK(Dk[2][2] == doctest::Approx(1.0 / 2048));
+    CHECK(Dk[0][1] == 0);
+
+    SquareMat I = A ^ 0;
+    CHECK((I ^ 12345)[2][2] == 1);
+
+    SquareMat U{{1, 1}, {0, 1}};              // unit diagonal but not the identity
+    CHECK((U ^ 3)[0][1] == 3);
+}
+
+// Test LU factorization: determinant, solves and inverse from one factorization
+TEST_CASE("LU factorization") {
+    using MatrixLib::LU;
+    SquareMat A{{0, 2, 1}, {4, 1, -1}, {2, 3, 5}};   // needs a row swap at step 0
+    LU f(A);
+    CHECK(f.det() == doctest::Approx(-34));
+    CHECK(f.det() == !A);
+    CHECK(f.logAbsDet() == doctest::Approx(std::log(34.0)));
+
+    double b[3] = {5, 2, 20};                           // A * {1, 1, 3}
+    double x[3];
+    f.solve(b, x);
+    CHECK(x[0] == doctest::Approx(1));
+    CHECK(x[1] == doctest::Approx(1));
+    CHECK(x[2] == doctest::Approx(3));
+    f.solve(b, b);                                      // in place
+    CHECK(b[2] == doctest::Approx(3));
+
+    SquareMat Ainv = f.inverse();
+    SquareMat I = A * Ainv;
+    bool identity = true;
+    for (std::size_t i = 0; i < 3; ++i)
+        for (std::size_t j = 0; j < 3; ++j)
+            identity = identity && std::fabs(I[i][j] - (i == j ? 1.0 : 0.0)) < 1e-12;
+    CHECK(identity);
+
+    SquareMat B{{1, 0, 2}, {0, 1, 0}, {3, 0, 1}};
+    SquareMat X = f.solve(B);
+    SquareMat R = A * X;
+    CHECK(R[2][0] == doctest::Approx(3));
+    CHECK(R[0][2] == doctest::Approx(2));
+
+    SquareMat S{{1, 2}, {2, 4}};                        // singular
+    LU g(S);
+    CHECK(g.isSingular());
+    CHECK(g.det() == 0);
+    CHECK_THROWS_AS(g.solve(S), std::logic_error);
+    SquareMat empty;
+    CHECK_THROWS_AS(LU{empty}, std::logic_error);
+}
+
+// Test the blocked LU path (panels + GEMM trailing update) on orders past the block threshold
+TEST_CASE("blocked LU") {
+    using MatrixLib::LU;
+    const std::size_t n = 301;                          // several panels and a short last one
+
+    // upper triangular U with its rows reversed: every panel has to pivot,
+    // and det = (+1 for 150 swaps) * product of U's diagonal
+    SquareMat P(n);
+    double logDet = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = i + 1; j < n; ++j)
+            P[n - 1 - i][j] = static_cast<double>((i * 7 + j * 13) % 17) / 17.0 - 0.5;
+        P[n - 1 - i][i] = 1.0 + 0.01 * static_cast<double>(i % 5);
+        logDet += std::log(P[n - 1 - i][i]);
+    }
+    LU f(P);
+    CHECK(f.logAbsDet() == doctest::Approx(logDet));
+    CHECK(f.det() > 0);
+
+    // diagonally dominant A: A * A^-1 == I to rounding
+    SquareMat A(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            A[i][j] = (i == j) ? static_cast<double>(n) : static_cast<double>((i * 31 + j * 17) % 23) / 23.0 - 0.5;
+    SquareMat R = A * LU(A).inverse();
+    double err = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            err = std::max(err, std::fabs(R[i][j] - (i == j ? 1.0 : 0.0)));
+    CHECK(err < 1e-12);
+
+    SquareMat S = A;                                    // duplicate rows: singular inside a later panel
+    for (std::size_t j = 0; j < n; ++j) S[200][j] = S[10][j];
+    CHECK(!S == 0);
+}
+
+// Test the task graph scheduler and the tiled LU built on it (same factors on any thread count)
+TEST_CASE("task graph & tiled LU") {
+    using MatrixLib::LU;
+    using MatrixLib::ThreadPool;
+    using MatrixLib::TaskGraph;
+
+    ThreadPool::configure(4);
+    // diamond 0 -> {1, 2} -> 3, plus a chain 4 -> 5
+    TaskGraph g(6);
+    g.depend(0, 1); g.depend(0, 2); g.depend(1, 3); g.depend(2, 3); g.depend(4, 5);
+    std::atomic<int> clock{0};
+    int when[6];
+    g.run([&](std::size_t t) { when[t] = clock.fetch_add(1); });
+    CHECK(clock.load() == 6);
+    CHECK(when[0] < when[1]);
+    CHECK(when[0] < when[2]);
+    CHECK(when[1] < when[3]);
+    CHECK(when[2] < when[3]);
+    CHECK(when[4] < when[5]);
+
+    TaskGraph cyclic(2);
+    cyclic.depend(0, 1); cyclic.depend(1, 0);
+    CHECK_THROWS_AS(cyclic.run([](std::size_t) {}), std::logic_error);
+
+    const std::size_t n = 450;
+    SquareMat A(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            A[i][j] = static_cast<double>((i * 37 + j * 11) % 29) / 29.0 - 0.5 + (i == j ? 4.0 : 0.0);
+    LU many(A);
+    ThreadPool::configure(1);
+    LU one(A);
+    ThreadPool::configure(0);
+
+    bool same = true;
+    for (std::size_t i = 0; i < n * n; ++i) same = same && many.factors()[i] == one.factors()[i];
+    for (std::size_t i = 0; i < n; ++i) same = same && many.pivots()[i] == one.pivots()[i];
+    CHECK(same);
+    CHECK(many.det() == one.det());
+
+    SquareMat R = A * many.inverse();
+    double err = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            err = std::max(err, std::fabs(R[i][j] - (i == j ? 1.0 : 0.0)));
+    CHECK(err < 1e-10);
+}
+
+// Test the unchecked accessors: same elements as operator[], one contiguous buffer
+TEST_CASE("unchecked access") {
+    SquareMat A{{1, 2, 3}, {4, 5, 6}, {7, 8, 9}};
+    const SquareMat& C = A;
+    CHECK(A.size() == 9);
+    CHECK(A.at_unchecked(1, 2) == A[1][2]);
+    CHECK(C.at_unchecked(2, 0) == 7);
+    CHECK(A.row_ptr(2) == A[2]);
+    CHECK(C.row_ptr(1)[1] == 5);
+    CHECK(A.data() + 3 == A.row_ptr(1));
+
+    A.at_unchecked(0, 0) = 10;
+    A.row_ptr(1)[0] = 40;
+    A.data()[8] = 90;
+    CHECK(A[0][0] == 10);
+    CHECK(A[1][0] == 40);
+    CHECK(A[2][2] == 90);
+
+    double s = 0;
+    for (const double* p = C.data(); p != C.data() + C.size(); ++p) s += *p;
+    CHECK(s == C.sum());
+    CHECK(SquareMat().data() == nullptr);
+}
+
+// Test the cached sum: every kind of mutation is seen, copies keep it, concurrent readers agree
+TEST_CASE("cached sum") {
+    SquareMat A{{1, 2}, {3, 4}};
+    CHECK(A.sum() == 10);
+    CHECK(A.sum() == 10);                  // from the cache
+
+    A[0][0] = 5;           CHECK(A.sum() == 14);
+    ++A;                   CHECK(A.sum() == 18);
+    A += A;                CHECK(A.sum() == 36);
+    A *= 0.5;              CHECK(A.sum() == 18);
+    A.at_unchecked(1, 1) = 0;  CHECK(A.sum() == 13);
+    A.data()[1] = 0;       CHECK(A.sum() == 10);
+    A = A + A;             CHECK(A.sum() == 20);
+    A %= 3;                CHECK(A.sum() == 2);
+    double first = A[0][0];                // a read through a non-const matrix
+    A[1][0] += 2;          CHECK(A.sum() == 4);
+    A[0][1]++;             CHECK(A.sum() == 5);
+    A[0][0] = A[1][0];     CHECK(A.sum() == 5 - first + A[1][0]);
+    double* row = A[1];    // a row as a pointer drops the cache when taken
+    row[1] -= 1;           CHECK(A.sum() == 4 - first + A[1][0]);
+
+    SquareMat B = A;                       // copy and move carry the cached value
+    SquareMat C = std::move(B);
+    CHECK(C.sum() == A.sum());
+    CHECK(B.sum() == 0);
+    C *= SquareMat{{1, 0}, {0, 1}};
+    CHECK(C == A);
+
+    // sorting compares cached sums
+    SquareMat M[4] = {SquareMat(8, 3.0), SquareMat(8, -1.0), SquareMat(8, 2.0), SquareMat(8, 0.0)};
+    std::sort(M, M + 4, [](const SquareMat& x, const SquareMat& y) { return x < y; });
+    CHECK(M[0][0][0] == -1);
+    CHECK(M[3][0][0] == 3);
+    CHECK(M[1] <= M[2]);
+    CHECK(M[2] >= M[2]);
+
+    // many threads filling the cache of one const matrix at once
+    const SquareMat big(300, 0.25);
+    double seen[4];
+    std::thread t[4];
+    for (int i = 0; i < 4; ++i) t[i] = std::thread([&, i] { seen[i] = big.sum(); });
+    for (auto& th : t) th.join();
+    for (double v : seen) CHECK(v == 22500);
+}
+
+// Test sum modes and the one-pass summary (min, max, norms) against direct loops
+TEST_CASE("sum modes & reductions") {
+    using MatrixLib::SumMode;
+    using namespace MatrixLib::detail;
+
+    // 1e16 absorbs every +1 added straight onto it; only Kahan keeps them all
+    SquareMat A(100, 1.0);
+    A[0][0] = 1e16;
+    double exact = 1e16 + 9999.0;            // rounds to 1e16 + 10000
+    CHECK(A.sum(SumMode::Kahan) == exact);
+    CHECK(std::fabs(A.sum(SumMode::Pairwise) - exact) <= 16);
+    CHECK(std::fabs(A.sum(SumMode::Fast) - exact) >= std::fabs(A.sum(SumMode::Kahan) - exact));
+    CHECK(A.sum(SumMode::Fast) == A.sum());
+
+    SquareMat M{{1, -2, 3}, {-4, 5, -6}, {7, -8, 9}};
+    SquareMat::Summary s = M.summary();
+    CHECK(s.min == -8);
+    CHECK(s.max == 9);
+    CHECK(s.norm1 == 18);
+    CHECK(s.normInf == 24);
+    CHECK(s.normFrobenius == doctest::Approx(std::sqrt(285.0)));
+    CHECK(M.trace() == 15);
+    CHECK(M.sum(SumMode::Pairwise) == 5);
+    CHECK(M.sum(SumMode::Kahan) == 5);
+    CHECK_THROWS_AS(SquareMat().summary(), std::logic_error);
+
+    // several row bands, same bits on any thread count
+    const std::size_t n = 301;
+    SquareMat B(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            B[i][j] = static_cast<double>((i * 131 + j * 71) % 997) - 498.5;
+    double mn = B[0][0], mx = B[0][0], rmax = 0, cmax = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        double r = 0, c = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            mn = std::min<double>(mn, B[i][j]);
+            mx = std::max<double>(mx, B[i][j]);
+            r += std::fabs(B[i][j]);
+            c += std::fabs(B[j][i]);
+        }
+        rmax = std::max(rmax, r);
+        cmax = std::max(cmax, c);
+    }
+    MatrixLib::ThreadPool::configure(4);
+    SquareMat::Summary many = B.summary();
+    double kahanMany = B.sum(SumMode::Kahan), pairMany = B.sum(SumMode::Pairwise);
+    MatrixLib::ThreadPool::configure(1);
+    SquareMat::Summary one = B.summary();
+    CHECK(B.sum(SumMode::Kahan) == kahanMany);
+    CHECK(B.sum(SumMode::Pairwise) == pairMany);
+    MatrixLib::ThreadPool::configure(0);
+    CHECK(many.min == mn);
+    CHECK(many.max == mx);
+    CHECK(many.normInf == rmax);
+    CHECK(many.norm1 == cmax);
+    CHECK(many.normFrobenius == one.normFrobenius);
+
+    // every SIMD table agrees bit for bit, over random rows of many lengths
+    // (fusing v * v + acc into an FMA changes sum a^2 in over a hundred of them)
+    const KernelTable& ref = kernelTable(Isa::SSE2);
+    std::uint64_t seed = 11;
+    double a[1003];
+    for (Isa isa : {Isa::AVX2, Isa::AVX512}) {
+        if (!isaSupported(isa)) continue;
+        const KernelTable& k = kernelTable(isa);
+        std::size_t mismatches = 0;
+        for (std::size_t len : {1u, 7u, 15u, 16u, 17u, 33u, 100u, 257u, 1003u})
+            for (int row = 0; row < 200; ++row) {
+                for (std::size_t i = 0; i < len; ++i) {
+                    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                    a[i] = static_cast<double>(seed >> 11) / 4503599627370496.0 - 1.0;
+                }
+                RowStats r, r0;
+                k.stats(a, len, r);
+                ref.stats(a, len, r0);
+                if (r.sumSq != r0.sumSq || r.sumAbs != r0.sumAbs || r.min != r0.min ||
+                    r.max != r0.max || k.sum(a, len) != ref.sum(a, len) ||
+                    k.sumKahan(a, len) != ref.sumKahan(a, len))
+                    ++mismatches;
+            }
+        CHECK(mismatches == 0);
+    }
+}
+
+// Test aligned storage, the allocator hook and padded internal strides
+TEST_CASE("aligned allocation & allocator hook") {
+    using namespace MatrixLib;
+    CHECK(g_countingInstalled);
+    CHECK(currentAllocator().allocate == countingAllocate);
+
+    for (std::size_t n : {1u, 3u, 17u, 100u}) {
+        SquareMat A(n, 1.0);
+        CHECK(reinterpret_cast<std::uintptr_t>(A.data()) % MATRIX_ALIGN == 0);
+    }
+
+    MatrixArena::release();  // empty free lists: every buffer reaches the hook
+    std::size_t before = g_hookAllocs;
+    {
+        SquareMat A(10, 2.0);
+        SquareMat B = A + A;
+        CHECK(B[9][9] == 4);
+    }
+    CHECK(g_hookAllocs - before == 2);
+
+    // power-of-two order: the LU workspace gets padded rows, results are unchanged
+    CHECK(detail::paddedStride(512) == 520);
+    CHECK(detail::paddedStride(500) == 500);
+    const std::size_t n = 256;
+    SquareMat M(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            M[i][j] = (i == j) ? 8.0 : static_cast<double>((i * 5 + j * 3) % 11) / 11.0 - 0.5;
+    LU f(M);
+    CHECK(f.stride() == n + 8);
+    SquareMat R = M * f.inverse();
+    double err = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            err = std::max(err, std::fabs(R[i][j] - (i == j ? 1.0 : 0.0)));
+    CHECK(err < 1e-12);
+
+    // huge pages only change how big buffers are backed
+    setHugePages(true);
+    SquareMat H(600, 1.0);                 // 2.9 MB
+    CHECK(reinterpret_cast<std::uintptr_t>(H.data()) % HUGE_PAGE == 0);
+    CHECK(H.sum() == 360000);
+    setHugePages(false);
+
+    // reduction partials come from the pool and the hook as well
+    MatrixArena::release();
+    before = g_hookAllocs;
+    CHECK(H.sum(SumMode::Kahan) == 360000);
+    CHECK(H.summary().max == 1);
+    CHECK(g_hookAllocs - before >= 2);
+}
+
+// Test the small-buffer pool and the scoped arena
+TEST_CASE("buffer pool & arena") {
+    using namespace MatrixLib;
+    MatrixArena::release();
+    resetPoolStats();
+    const std::size_t held = poolStats().bytesHeld;   // other threads' caches
+
+    // a freed small buffer is handed out again without touching the hook
+    double* first;
+    {
+        SquareMat A(5, 1.0);
+        first = A.data();
+    }
+    CHECK(poolStats().bytesHeld - held == 256);   // 200 bytes round up to the 256 B class
+    std::size_t hooked = g_hookAllocs;
+    {
+        SquareMat B(6, 2.0);               // 288 bytes: next class, a miss
+        SquareMat C(9, 3.0);               // 648 bytes: a miss
+        SquareMat D(5, 4.0);               // same class as A: reused
+        CHECK(D.data() == first);
+        CHECK(D.sum() == 100);
+    }
+    CHECK(g_hookAllocs - hooked == 2);
+    PoolStats s = poolStats();
+    CHECK(s.requests == 4);
+    CHECK(s.hits == 1);
+    CHECK(s.misses == 3);
+    CHECK(s.hitRate() == doctest::Approx(0.25));
+
+    // big buffers bypass the pool
+    {
+        SquareMat Big(100, 1.0);
+    }
+    CHECK(poolStats().misses == 3);
+    CHECK(poolStats().bytesHeld - held == 256 + 512 + 1024);
+
+    // a loop of small expressions runs from recycled buffers
+    resetPoolStats();
+    {
+        MatrixArena arena;
+        SquareMat X(8, 0.5);
+        for (int it = 0; it < 100; ++it) {
+            SquareMat Y = X * X + X;
+            X = Y * 0.25;
+        }
+        CHECK(poolStats().hitRate() > 0.95);
+        CHECK(poolStats().bytesHeld > held);
+    }
+    // leaving the arena hands this thread's cache back; live matrices are untouched
+    CHECK(poolStats().bytesHeld == held);
+
+    SquareMat kept;
+    {
+        MatrixArena arena;
+        kept = SquareMat(3, 7.0);
+    }
+    CHECK(kept.sum() == 63);
+}
+
+// Test inline storage of small orders: no heap buffer, copies, moves and swaps stay correct
+TEST_CASE("inline storage for small orders") {
+    using namespace MatrixLib;
+    std::size_t before = matrixAllocs();
+    SquareMat R{{0, -1, 0}, {1, 0, 0}, {0, 0, 1}};   // quarter turn about z
+    SquareMat S{{2, 0, 0}, {0, 2, 0}, {0, 0, 2}};
+    SquareMat T = R * S + R;
+    T *= R;
+    SquareMat P = R ^ 5;
+    if (SquareMat::INLINE_ORDER >= 3) CHECK(matrixAllocs() - before == 0);
+    CHECK(reinterpret_cast<std::uintptr_t>(T.data()) % MATRIX_ALIGN == 0);
+    CHECK(T[0][0] == -3);                  // 3 R * R = 3 * (half turn)
+    CHECK(T[2][2] == 3);
+    CHECK(P[0][1] == -1);                  // R^5 == R
+    CHECK(P[1][0] == 1);
+
+    // moves copy the inline elements; the source is left empty
+    SquareMat M = std::move(T);
+    CHECK(M[0][0] == -3);
+    CHECK(T.order() == 0);
+    T = std::move(M);
+    CHECK(T[2][2] == 3);
+    CHECK(M.order() == 0);
+
+    // copy and swap, across inline and heap storage in both directions
+    SquareMat Big(6, 1.0);
+    const double* bigBuf = Big.data();
+    SquareMat C = R;
+    swap(C, Big);
+    CHECK(C.order() == 6);
+    CHECK(C.data() == bigBuf);             // the heap buffer changed hands
+    CHECK(Big.order() == 3);
+    CHECK(Big[1][0] == 1);
+    CHECK(C.sum() == 36);
+    Big = C;
+    CHECK(Big.sum() == 36);
+    C = R;
+    CHECK(C[0][1] == -1);
+    C.swap(C);
+    CHECK(C[0][1] == -1);
+
+    // a malformed initializer list does not leak either storage kind
+    CHECK_THROWS_AS((SquareMat{{1, 2}, {3}}), std::invalid_argument);
+    CHECK_THROWS_AS((SquareMat{{1, 2, 3, 4, 5}, {1, 2, 3, 4, 5}, {1}, {1}, {1}}), std::invalid_argument);
+}
+
+// Test the fixed-order matrix: constexpr evaluation, closed-form determinants, conversions
+TEST_CASE("fixed-order matrix") {
+    using MatrixLib::FixedSquareMat;
+    using F3 = FixedSquareMat<3>;
+
+    // whole expressions fold at compile time
+    constexpr F3 A{{2, 0, 1}, {1, 3, 2}, {1, 1, 2}};
+    constexpr F3 B = (A * F3::identity() + ~A) % A - 2 * A / 2.0;
+    static_assert(B[0][2] == 1 * (1 + 1) - 1, "element-wise ops");
+    static_assert((!A) == 6.0, "3 x 3 closed form");
+    static_assert((A ^ 3)[1][1] == (A * A * A)[1][1], "power");
+    static_assert((!FixedSquareMat<2>{{1, 2}, {3, 4}}) == -2.0, "2 x 2 closed form");
+    static_assert((!FixedSquareMat<4>{{1, 0, 2, -1}, {3, 0, 0, 5}, {2, 1, 4, -3}, {1, 0, 5, 0}}) == 30.0,
+                  "4 x 4 closed form");
+    static_assert((!FixedSquareMat<3>{{1, 2, 3}, {2, 4, 6}, {0, 1, 1}}) == 0.0, "singular");
+    static_assert(A != B && A > F3() && F3(1.0) == F3{{9, 0, 0}, {0, 0, 0}, {0, 0, 0}}, "sum order");
+
+    // closed forms and the general path agree with LU
+    auto fill = [](auto& m, std::size_t n, unsigned seed) {
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                m[i][j] = static_cast<double>((i * 7 + j * 13 + seed) % 17) / 4.0 - 2.0;
+    };
+    FixedSquareMat<4> F4;
+    FixedSquareMat<6> F6;
+    fill(F4, 4, 3);
+    fill(F6, 6, 5);
+    SquareMat D4 = F4.toSquareMat(), D6 = static_cast<SquareMat>(F6);
+    CHECK((!F4) == doctest::Approx(!D4));
+    CHECK((!F6) == doctest::Approx(!D6));
+
+    // same results as the dynamic matrix
+    SquareMat P = D4 * D4 + ~D4;
+    FixedSquareMat<4> Q = F4 * F4 + ~F4;
+    bool same = true;
+    for (std::size_t i = 0; i < 4; ++i)
+        for (std::size_t j = 0; j < 4; ++j)
+            same = same && P[i][j] == Q[i][j];
+    CHECK(same);
+    CHECK(FixedSquareMat<4>(P) == Q);
+    CHECK(((F4 * 4.0) % 3)[0][0] == doctest::Approx(((D4 * 4.0) % 3)[0][0]));
+
+    CHECK_THROWS_AS(FixedSquareMat<3>{D4}, std::invalid_argument);
+    CHECK_THROWS_AS((F3{{1, 2}, {3, 4}}), std::invalid_argument);
+    CHECK_THROWS_AS(F3() / 0.0, std::invalid_argument);
+
+    std::ostringstream a, b;
+    a << F4;
+    b << D4;
+    CHECK(a.str() == b.str());
+}
+
+// Test the small-order determinant dispatch against LU
+TEST_CASE("small-order determinants") {
+    using MatrixLib::LU;
+    for (std::size_t n = 1; n <= 10; ++n) {
+        SquareMat A(n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                A[i][j] = static_cast<double>((i * 7 + j * 11 + n) % 13) / 3.0 - 2.0;
+        double ref = LU(A).det();
+        std::size_t before = matrixAllocs();
+        double d = !A;
+        if (n <= 8) CHECK(matrixAllocs() - before == 0);   // no heap copy
+        if (n >= 5) CHECK(d == ref);                       // same elimination, same bits
+        else CHECK(d == doctest::Approx(ref).epsilon(1e-12));
+    }
+
+    // singular and near-singular inputs still read as 0
+    SquareMat S{{1, 2, 3}, {2, 4, 6}, {7, 8, 9}};
+    CHECK(!S == 0.0);
+    SquareMat T(6, 1.0);
+    CHECK(!T == 0.0);
+    SquareMat R{{1e-6, 0}, {0, 1e-6}};
+    CHECK(!R == 0.0);
+
+    // a pivot below EPS: closed forms (n <= 4) keep the exact determinant,
+    // the eliminations (n >= 5, and LU at any order) read it as singular
+    for (std::size_t n = 2; n <= 6; ++n) {
+        SquareMat G(n, 0.0);
+        G[0][0] = 1e-10;
+        G[1][1] = 1e10;
+        for (std::size_t i = 2; i < n; ++i) G[i][i] = 1.0;
+        CHECK(LU(G).det() == 0.0);
+        if (n <= 4) CHECK(!G == doctest::Approx(1.0));
+        else CHECK(!G == 0.0);
+    }
+}
+
+// Test Strassen-Winograd: odd orders, error bounds, and opt-in use by * and ^
+TEST_CASE("strassen-winograd multiply") {
+    using namespace MatrixLib;
+    const std::size_t n = 301;   // 301 -> 150 -> 75 -> 37: peels at two levels
+    SquareMat A(n), B(n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            A[i][j] = static_cast<double>((i * 7 + j * 3) % 11) / 11.0 - 0.5;
+            B[i][j] = static_cast<double>((i * 5 + j * 13) % 17) / 17.0 - 0.5;
+        }
+    SquareMat C = A * B;   // classic
+
+    setStrassen(true, 64);
+    StrassenReport r;
+    SquareMat S = strassen(A, B, &r);
+    CHECK(r.levels == 3);
+    CHECK(r.leaf == 37);
+    CHECK(r.bound > r.classicBound);
+    double err = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            err = std::max(err, std::fabs(S[i][j] - C[i][j]));
+    CHECK(err > 0);                             // a genuinely different algorithm
+    CHECK(err <= r.bound + r.classicBound);
+
+    // operator*, *= and the squarings of ^ take the same path once enabled
+    SquareMat P = A * B;
+    CHECK(P.sum() == S.sum());
+    SquareMat Q = A;
+    Q *= B;
+    CHECK(Q.sum() == S.sum());
+    SquareMat M = A / 40.0;
+    SquareMat M3 = M ^ 3;
+    setStrassen(false);
+    SquareMat ref = M * M * M;
+    double err3 = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            err3 = std::max(err3, std::fabs(M3[i][j] - ref[i][j]));
+    CHECK(err3 < 1e-12);
+
+    // at or below the crossover it is plain GEMM
+    SquareMat a(40, 0.5), b(40, 2.0);
+    strassen(a, b, &r);
+    CHECK(r.levels == 0);
+    CHECK(r.bound == r.classicBound);
+    CHECK_THROWS_AS(setStrassen(true, 1), std::invalid_argument);
+    CHECK_THROWS_AS(strassen(a, SquareMat(3)), std::invalid_argument);
+}
+
+// Test the SoA batch against per-matrix SquareMat results
+TEST_CASE("matrix batch") {
+    using MatrixLib::SquareMatBatch;
+    using MatrixLib::LU;
+    for (std::size_t n : {2u, 3u, 4u, 6u}) {
+        const std::size_t count = 21;   // not a multiple of the lane count
+        SquareMatBatch A(n, count), B(n, count);
+        for (std::size_t k = 0; k < count; ++k)
+            for (std::size_t i = 0; i < n; ++i)
+                for (std::size_t j = 0; j < n; ++j) {
+                    A.at(k, i, j) = static_cast<double>((k * 3 + i * 7 + j * 5) % 11) / 4.0 - 1.0 + (i == j ? 2.0 : 0.0);
+                    B.at(k, i, j) = static_cast<double>((k + i * 2 + j * 9) % 7) / 3.0 - 1.0;
+                }
+        // make one matrix singular (two equal rows)
+        for (std::size_t j = 0; j < n; ++j) A.at(5, 1, j) = A.at(5, 0, j);
+
+        SquareMatBatch C = A * B, T = ~A, P = A ^ 5;
+        double* d = new double[count];
+        A.det(d);
+        bool* sing = new bool[count];
+        SquareMatBatch I = A.inverse(sing);
+
+        bool sameMul = true, sameT = true, sameDet = true, powClose = true, invClose = true;
+        for (std::size_t k = 0; k < count; ++k) {
+            SquareMat a = A.get(k), b = B.get(k);
+            SquareMat c = a * b, p = a ^ 5;
+            sameDet = sameDet && d[k] == !a;   // same algorithm, same bits
+            for (std::size_t i = 0; i < n; ++i)
+                for (std::size_t j = 0; j < n; ++j) {
+                    sameMul = sameMul && C.at(k, i, j) == c[i][j];
+                    sameT = sameT && T.at(k, i, j) == a[j][i];
+                    powClose = powClose && std::fabs(P.at(k, i, j) - p[i][j]) < 1e-9 * (1 + std::fabs(p[i][j]));
+                }
+            if (k == 5) continue;
+            SquareMat inv = LU(a).inverse();
+            for (std::size_t i = 0; i < n; ++i)
+                for (std::size_t j = 0; j < n; ++j)
+                    invClose = invClose && std::fabs(I.at(k, i, j) - inv[i][j]) < 1e-10;
+        }
+        CHECK(sameMul);
+        CHECK(sameT);
+        CHECK(sameDet);
+        CHECK(powClose);
+        CHECK(invClose);
+        CHECK(d[5] == 0.0);
+        CHECK(sing[5]);
+        CHECK(!sing[4]);
+        CHECK(std::isnan(I.at(5, 0, 0)));
+        CHECK_THROWS_AS(A.inverse(), std::logic_error);
+        delete[] d;
+        delete[] sing;
+    }
+
+    SquareMatBatch E(3, 4, 1.0);
+    SquareMat M{{1, 2, 3}, {4, 5, 6}, {7, 8, 10}};
+    E.set(2, M);
+    CHECK(E.get(2)[2][2] == 10);
+    CHECK(E.get(1).sum() == 9);
+    CHECK(E.plane(2, 2)[2] == 10);
+    CHECK(((E ^ 0).get(3))[1][1] == 1);
+    CHECK_THROWS_AS(E.set(0, SquareMat(2)), std::invalid_argument);
+    CHECK_THROWS_AS(E.get(4), std::out_of_range);
+    CHECK_THROWS_AS(E * SquareMatBatch(3, 5), std::invalid_argument);
+}
+
+// Test the binary format: round trips, byte order, corruption and mapped matrices
+TEST_CASE("binary files & mapped matrices") {
+    const char* path = "matfile_test.sqm";
+    SquareMat A(7);
+    for (std::size_t i = 0; i < 7; ++i)
+        for (std::size_t j = 0; j < 7; ++j)
+            A[i][j] = static_cast<double>(i * 7 + j) / 3.0 - 5.0;
+    auto sameBits = [](const SquareMat& x, const SquareMat& y) {
+        return x.order() == y.order() &&
+               std::equal(x.data(), x.data() + x.size(), y.data());
+    };
+    // raw bytes of the file, for the corruption checks
+    auto readAll = [&](unsigned char* buf, std::size_t len) {
+        std::FILE* f = std::fopen(path, "rb");
+        REQUIRE(f);
+        CHECK(std::fread(buf, 1, len, f) == len);
+        std::fclose(f);
+    };
+    auto writeAll = [&](const unsigned char* buf, std::size_t len) {
+        std::FILE* f = std::fopen(path, "wb");
+        REQUIRE(f);
+        CHECK(std::fwrite(buf, 1, len, f) == len);
+        std::fclose(f);
+    };
+    const std::size_t bytes = MatrixLib::MATFILE_HEADER + 49 * sizeof(double);
+
+    A.save(path);
+    CHECK(sameBits(SquareMat::load(path), A));
+    SquareMat S{{1, 2}, {3, 4}};
+    S.save(path);
+    CHECK(sameBits(SquareMat::load(path), S));
+    SquareMat().save(path);   // header only (no payload write from a null buffer)
+    CHECK(SquareMat::load(path).order() == 0);
+    CHECK(SquareMat::load(path) == SquareMat());
+    CHECK(!SquareMat::mapFile(path, MatrixLib::MapMode::Private, true).isMapped());
+
+    // private mapping: operators read the file in place, writes never reach it
+    A.save(path);
+    {
+        SquareMat M = SquareMat::mapFile(path, MatrixLib::MapMode::Private, true);
+        CHECK(M.isMapped());
+        CHECK(sameBits(M, A));
+        CHECK(sameBits(M * M, A * A));
+        CHECK(!M == doctest::Approx(!A));
+        M[0][0] = 100;
+        M += A;
+        CHECK(M.isMapped());
+        CHECK(M[0][0] == 100 + A[0][0]);
+        SquareMat copy(M);
+        CHECK(!copy.isMapped());
+    }
+    CHECK(sameBits(SquareMat::load(path), A));
+
+    // shared mapping: same-order assignments write through, the checksum is resealed
+    {
+        SquareMat M = SquareMat::mapFile(path, MatrixLib::MapMode::Shared);
+        M *= A;
+        M = M - A;
+        CHECK(M.isMapped());
+        CHECK_THROWS_AS(SquareMat::load(path), std::invalid_argument);   // not sealed while open
+        M.sync();
+        CHECK(sameBits(SquareMat::load(path), A * A - A));
+        M[1][1] = 42;
+    }
+    SquareMat B = SquareMat::load(path);
+    CHECK(B[1][1] == 42);
+    B.save(path);
+
+    // foreign byte order: load swaps, mapFile refuses
+    unsigned char raw[MatrixLib::MATFILE_HEADER + 49 * sizeof(double)];
+    readAll(raw, bytes);
+    auto reverse = [](unsigned char* p, std::size_t len) { std::reverse(p, p + len); };
+    reverse(raw + 8, 4);
+    reverse(raw + 16, 8);
+    reverse(raw + 24, 8);
+    for (std::size_t k = 0; k < 49; ++k) reverse(raw + MatrixLib::MATFILE_HEADER + k * 8, 8);
+    raw[13] = raw[13] == MatrixLib::MATFILE_LITTLE ? MatrixLib::MATFILE_BIG : MatrixLib::MATFILE_LITTLE;
+    writeAll(raw, bytes);
+    CHECK(sameBits(SquareMat::load(path), B));
+    CHECK_THROWS_AS(SquareMat::mapFile(path), std::invalid_argument);
+
+    // corruption is caught by the checksum; a bad header or size before that
+    B.save(path);
+    readAll(raw, bytes);
+    raw[MatrixLib::MATFILE_HEADER + 100] ^= 1;
+    writeAll(raw, bytes);
+    CHECK_THROWS_AS(SquareMat::load(path), std::invalid_argument);
+    CHECK_THROWS_AS(SquareMat::mapFile(path, MatrixLib::MapMode::Private, true), std::invalid_argument);
+    CHECK(SquareMat::mapFile(path).order() == 7);   // unverified maps are not read
+    writeAll(raw, bytes - 8);
+    CHECK_THROWS_AS(SquareMat::load(path), std::invalid_argument);
+    CHECK_THROWS_AS(SquareMat::mapFile(path), std::invalid_argument);
+    raw[0] = 'X';
+    writeAll(raw, bytes);
+    CHECK_THROWS_AS(SquareMat::load(path), std::invalid_argument);
+    std::remove(path);
+    CHECK_THROWS_AS(SquareMat::load(path), std::runtime_error);
+
+    // the checksum does not depend on the thread count
+    SquareMat L(300, 0.5);
+    L[299][299] = 1.0;
+    std::uint64_t one = MatrixLib::detail::checksum(L.data(), L.size());
+    MatrixLib::ThreadPool::configure(4);
+    CHECK(MatrixLib::detail::checksum(L.data(), L.size()) == one);
+    MatrixLib::ThreadPool::configure(0);
+    L[0][0] = 0.25;
+    CHECK(MatrixLib::detail::checksum(L.data(), L.size()) != one);
+}
+
+// Test the text form: exact round trips through <<, parse, >> and format
+TEST_CASE("text parse & format") {
+    SquareMat A{{0.1, -2.5, 1.0 / 3}, {1e-300, 6.02214076e23, -0.0}, {5, 1e21, 123456789.125}};
+    std::ostringstream os;
+    os << A;
+    CHECK(os.str().substr(0, 11) == "[ 0.1, -2.5");
+    auto sameBits = [](const SquareMat& x, const SquareMat& y) {
+        return x.order() == y.order() &&
+               std::equal(x.data(), x.data() + x.size(), y.data(), [](double a, double b) {
+                   return std::memcmp(&a, &b, sizeof a) == 0;
+               });
+    };
+    SquareMat P = SquareMat::parse(os.str());
+    CHECK(sameBits(P, A));
+    CHECK(std::signbit(P[1][2]));
+
+    // format() into a caller buffer: same text, or value_too_large without overrun
+    char* buf = new char[A.textBound()];
+    std::to_chars_result r = A.format(buf, buf + A.textBound());
+    CHECK(r.ec == std::errc());
+    CHECK(std::string(buf, r.ptr) == os.str());
+    std::size_t len = static_cast<std::size_t>(r.ptr - buf);
+    CHECK(A.format(buf, buf + len).ec == std::errc());
+    CHECK(A.format(buf, buf + len - 1).ec == std::errc::value_too_large);
+    delete[] buf;
+
+    // whitespace is free-form; inf and nan read back; empty text is the empty matrix
+    SquareMat Q = SquareMat::parse("  [1,+2]\t[ inf ,-3e-2 ]  \n");
+    CHECK(Q.order() == 2);
+    CHECK(Q[0][1] == 2);
+    CHECK(std::isinf(Q[1][0]));
+    CHECK(Q[1][1] == -0.03);
+    CHECK(std::isnan(SquareMat::parse("[ nan ]")[0][0]));
+    CHECK(SquareMat::parse(" \n").order() == 0);
+
+    CHECK_THROWS_AS(SquareMat::parse("[ 1, 2 ]\n[ 3 ]"), std::invalid_argument);          // short row
+    CHECK_THROWS_AS(SquareMat::parse("[ 1, 2 ]\n[ 3, 4, 5 ]"), std::invalid_argument);     // long row
+    CHECK_THROWS_AS(SquareMat::parse("[ 1, 2 ]\n"), std::invalid_argument);                // missing row
+    CHECK_THROWS_AS(SquareMat::parse("[ 1 ] [ 2 ]"), std::invalid_argument);               // trailing row
+    CHECK_THROWS_AS(SquareMat::parse("[ 1, x ]"), std::invalid_argument);
+    CHECK_THROWS_AS(SquareMat::parse("[ ]"), std::invalid_argument);
+    std::string msg;
+    try {
+        SquareMat::parse("[ 1, 2 ]\n[ 3; 4 ]");
+    } catch (const std::invalid_argument& e) {
+        msg = e.what();
+    }
+    CHECK(msg.find("offset 12") != std::string::npos);
+
+    // >> reads one matrix at a time and stops after its last row
+    std::istringstream in(os.str() + "\n[ 7 ]\n[ 1, 2 ] junk");
+    SquareMat X, Y, Z{{9}};
+    in >> X >> Y;
+    CHECK(sameBits(X, A));
+    CHECK(Y.order() == 1);
+    CHECK(Y[0][0] == 7);
+    CHECK(!in.fail());
+    in >> Z;
+    CHECK(in.fail());
+    CHECK(Z[0][0] == 9);   // unchanged on failure
+
+    // a large matrix (rows formatted in parallel) survives the round trip bit for bit
+    SquareMat L(200);
+    for (std::size_t i = 0; i < 200; ++i)
+        for (std::size_t j = 0; j < 200; ++j)
+            L[i][j] = std::sin(static_cast<double>(i * 200 + j)) * std::pow(10.0, static_cast<double>(j % 40) - 20);
+    std::stringstream io;
+    io << L;
+    SquareMat L2;
+    io >> L2;
+    CHECK(sameBits(L2, L));
+    CHECK(sameBits(SquareMat::parse(io.str()), L));
+    char* big = new char[L.textBound()];
+    r = L.format(big, big + L.textBound());
+    CHECK(std::string(big, r.ptr) == io.str());
+    CHECK(L.format(big, big + io.str().size() - 1).ec == std::errc::value_too_large);
+    delete[] big;
+}
+
+// Test the out-of-core matrix: tiled products, LU determinant and cache budget against SquareMat
+TEST_CASE("out-of-core matrix") {
+    using MatrixLib::TiledMat;
+    using MatrixLib::TiledConfig;
+    const std::size_t n = 53;   // not a multiple of the tile: edge tiles are padded
+    SquareMat A(n), B(n);
+    std::uint64_t seed = 7;
+    auto next = [&] {   // LCG in [-1, 1)
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<double>(seed >> 11) / 4503599627370496.0 - 1.0;
+    };
+    for (std::size_t k = 0; k < n * n; ++k) {
+        A.data()[k] = next();
+        B.data()[k] = next();
+    }
+    TiledConfig small;
+    small.tile = 16;
+    small.budget = 6 * 16 * 16 * sizeof(double);   // 6 of the 16 tiles
+    TiledConfig roomy = small;
+    roomy.budget = 64 * 16 * 16 * sizeof(double);
+    auto close = [](const SquareMat& x, const SquareMat& y) {
+        for (std::size_t k = 0; k < x.size(); ++k)
+            if (std::fabs(x.data()[k] - y.data()[k]) > 1e-9) return false;
+        return x.order() == y.order();
+    };
+    auto sameBits = [](const SquareMat& x, const SquareMat& y) {
+        return x.order() == y.order() && std::equal(x.data(), x.data() + x.size(), y.data());
+    };
+
+    TiledMat TA(A, small), TB(B, small);
+    CHECK(sameBits(TA.toSquareMat(), A));
+    CHECK(sameBits((TA + TB).toSquareMat(), A + B));
+    CHECK(sameBits((TA - TB).toSquareMat(), A - B));
+    CHECK(sameBits((2.5 * TA).toSquareMat(), A * 2.5));
+    CHECK(sameBits((~TA).toSquareMat(), ~A));
+    SquareMat prod = (TA * TB).toSquareMat();
+    CHECK(close(prod, A * B));
+    CHECK(TA.sum() == doctest::Approx(A.sum()));
+
+    // evictions happened, yet the budget was kept and the result is budget-independent
+    MatrixLib::TileStats st = TA.stats();
+    CHECK(st.capacity == 6);
+    CHECK(st.resident <= st.capacity);
+    CHECK(st.misses > 16);
+    CHECK(sameBits((TiledMat(A, roomy) * TiledMat(B, roomy)).toSquareMat(), prod));
+
+    // element access writes through the cache and survives eviction
+    TiledMat C(TA);
+    C.set(50, 2, 42.0);
+    CHECK((C + TB).get(0, 0) == doctest::Approx(A[0][0] + B[0][0]));
+    CHECK(C.get(50, 2) == 42.0);
+    CHECK(TA.get(50, 2) == A[50][2]);
+    CHECK(C.stats().writes > 0);
+    C.flush();
+    std::size_t written = C.stats().writes;
+    C.set(1, 1, 7.0);
+    C.flush();   // exactly the one dirty tile
+    CHECK(C.stats().writes == written + 1);
+    CHECK(C.get(1, 1) == 7.0);
+    CHECK_THROWS_AS(C.get(n, 0), std::out_of_range);
+    TiledMat F(20, small, 1.5);
+    CHECK(F.sum() == doctest::Approx(600.0));
+
+    // determinant through the left-looking LU, pivoting across tiles
+    MatrixLib::LU lu(A);
+    CHECK(TA.logAbsDet() == doctest::Approx(lu.logAbsDet()));
+    CHECK(!TA == doctest::Approx(lu.det()));
+    SquareMat D(20);
+    for (std::size_t i = 0; i < 20; ++i)
+        for (std::size_t j = 0; j < 20; ++j)
+            D[i][j] = (i + 2 * j) % 7 + (i == j ? 3.0 : 0.0) - 2.0;
+    CHECK(!TiledMat(D, small) == doctest::Approx(!D));
+    SquareMat Sg = A;
+    for (std::size_t j = 0; j < n; ++j) Sg[40][j] = Sg[3][j];
+    CHECK(!TiledMat(Sg, small) == 0);
+    CHECK(std::isinf(TiledMat(Sg, small).logAbsDet()));
+    CHECK_THROWS_AS(!TiledMat(0, small), std::logic_error);
+
+    // the factorization stays inside the matrix's budget
+    st = TA.stats();
+    CHECK(st.resident <= st.capacity);
+    CHECK(st.capacity == 6);
+    TiledConfig tight = small;
+    tight.budget = 5 * 16 * 16 * sizeof(double);   // 4 tile rows need 4 + 2
+    CHECK_THROWS_AS(!TiledMat(A, tight), std::logic_error);
+    CHECK(TiledMat(A, tight).sum() == doctest::Approx(A.sum()));
+
+    // two threads taking the determinant of one const matrix share its cache
+    const TiledMat& shared = TA;
+    double dets[2];
+    std::thread th[2];
+    for (int i = 0; i < 2; ++i) th[i] = std::thread([&, i] { dets[i] = !shared; });
+    for (auto& x : th) x.join();
+    CHECK(dets[0] == !TA);
+    CHECK(dets[1] == !TA);
+    CHECK(TA.stats().resident <= TA.stats().capacity);
+
+    // streamed through matrix files in both directions
+    const char* path = "tiled_test.sqm";
+    prod.save(path);
+    CHECK(sameBits(TiledMat::load(path, small).toSquareMat(), prod));
+    TB.save(path);
+    CHECK(sameBits(SquareMat::load(path), B));
+    std::remove(path);
+
+    CHECK_THROWS_AS(TiledMat(10, TiledConfig{16, 3 * 16 * 16 * sizeof(double), ""}), std::invalid_argument);
+    CHECK_THROWS_AS(A + TiledMat(5, small).toSquareMat(), std::invalid_argument);
+    CHECK_THROWS_AS(TA + TiledMat(5, small), std::invalid_argument);
+}